@@ -0,0 +1,11 @@
+@echo off
+
+@REM just the simulation, no window or gpu. See headless.c
+
+call run_codegen.bat || goto :error
+cl /Igen /Ithirdparty /W3 /Zi /WX /O2 headless.c || goto :error
+goto :EOF
+
+:error
+echo Failed to build
+exit /B %ERRORLEVEL%
@@ -0,0 +1,9 @@
+#!/bin/sh
+# just the simulation, no window or gpu, for running on linux. See headless.c.
+# Needs the bought assets in assets/copyrighted like run_codegen.bat, but not sokol-shdc
+set -e
+
+mkdir -p gen assets/baked
+cc -Ithirdparty codegen.c -o codegen -lm -lpthread
+./codegen
+cc -std=gnu11 -O2 -Igen -Ithirdparty headless.c -o headless -lm
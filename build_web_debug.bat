@@ -5,7 +5,9 @@ mkdir build_web
 
 call run_codegen.bat || goto :error
 
-emcc -O2 -s ALLOW_MEMORY_GROWTH --source-map-base . -gsource-map -DDEVTOOLS -Ithirdparty -Igen main.c -o build_web\index.html --preload-file assets --shell-file web_template.html || goto :error
+emcc -O2 -msimd128 -s ALLOW_MEMORY_GROWTH --source-map-base . -gsource-map -DDEVTOOLS -Ithirdparty -Igen main.c -o build_web\index.html --preload-file assets --exclude-file *.png --exclude-file assets/baked/images.pack --shell-file web_template.html || goto :error
+rem downloaded after the page starts instead of preloaded, see start_loading_images
+copy assets\baked\images.pack build_web\images.pack || goto :error
 
 goto :EOF
 
@@ -6,7 +6,9 @@ mkdir build_web_release
 call run_codegen.bat || goto :error
 
 echo Building release
-emcc -DNDEBUG -O2 -DDEVTOOLS -s ALLOW_MEMORY_GROWTH -Ithirdparty -Igen main.c -o build_web_release\index.html --preload-file assets --shell-file web_template.html || goto :error
+emcc -DNDEBUG -O2 -msimd128 -DDEVTOOLS -s ALLOW_MEMORY_GROWTH -Ithirdparty -Igen main.c -o build_web_release\index.html --preload-file assets --exclude-file *.png --exclude-file assets/baked/images.pack --shell-file web_template.html || goto :error
+rem downloaded after the page starts instead of preloaded, see start_loading_images
+copy assets\baked\images.pack build_web_release\images.pack || goto :error
 
 goto :EOF
 
@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
-#define assert(cond, explanation) { if(!cond) { printf("Codegen assertion line %d %s failed: %.*s\n", __LINE__, #cond, MD_S8VArg(explanation)); __debugbreak(); exit(1); } }
+#include "jobs.c" // levels, images and shaders are made at the same time, on its threads
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#undef assert // the one here takes an explanation
+
+#ifndef _MSC_VER
+#define __debugbreak() // so it builds on linux too, for the headless build
+#endif
+#define assert(cond, explanation) { if(!(cond)) { printf("Codegen assertion line %d %s failed: %.*s\n", __LINE__, #cond, MD_S8VArg((explanation))); __debugbreak(); exit(1); } }
 
 #pragma warning(disable : 4996) // nonsense about fopen being insecure
 
@@ -12,9 +24,13 @@
 #include "md.c"
 #pragma warning(pop)
 
+#include "level_format.h"
+#include "image_pack_format.h"
+
 
 MD_String8 OUTPUT_FOLDER = MD_S8LitComp("gen"); // no trailing slash
 MD_String8 ASSETS_FOLDER = MD_S8LitComp("assets");
+MD_String8 BAKED_FOLDER = MD_S8LitComp("assets/baked"); // binary assets made from the others, loaded at runtime
 
 #define log(...) { printf("Codegen: "); printf(__VA_ARGS__); }
 
@@ -101,32 +117,495 @@ char* goto_end_of(char *tomove, size_t max_move, char *pattern) {
     return NULL;
 }
 
+// keep in sync with TileFlags in sim.c
+#define TILE_SOLID (1 << 0)
+#define TILE_COLLISION_SHAPE (1 << 1)
+
+typedef struct ParsedTileset {
+    MD_String8 name;
+    uint8_t *flags;
+    int tile_count;
+} ParsedTileset;
+
+#define ARRLEN(x) (sizeof(x)/sizeof((x)[0]))
+ParsedTileset tilesets[16] = {0};
+int num_tilesets = 0;
+
+ParsedTileset *find_tileset(MD_String8 name) {
+    for(int i = 0; i < num_tilesets; i++) {
+        if(MD_S8Match(tilesets[i].name, name, 0)) return &tilesets[i];
+    }
+    assert(false, MD_S8Fmt(cg_arena, "No tileset named '%.*s', tilesets must come before the levels that use them", MD_S8VArg(name)));
+    return NULL;
+}
+
 #define list_printf(list_ptr, ...) MD_S8ListPush(cg_arena, list_ptr, MD_S8Fmt(cg_arena, __VA_ARGS__))
 
+MD_String8 upper(MD_String8 s) {
+    MD_String8 to_return = MD_S8Copy(cg_arena, s);
+    for(int i = 0; i < to_return.size; i++) to_return.str[i] = MD_CharToUpper(to_return.str[i]);
+    return to_return;
+}
+
+MD_String8List image_names = {0}; // upper case, without the IMAGE_ in front
+
+// images are referred to as image_name, and are an ImageId in the generated code so
+// that only what draws needs sokol
+bool is_image_reference(MD_String8 name) {
+    MD_String8 prefix = MD_S8Lit("image_");
+    if(name.size <= prefix.size || !MD_S8Match(MD_S8Prefix(name, prefix.size), prefix, 0)) return false;
+    MD_String8 image = upper(MD_S8Skip(name, prefix.size));
+    for(MD_String8Node *it = image_names.first; it != NULL; it = it->next) {
+        if(MD_S8Match(it->string, image, 0)) return true;
+    }
+    return false;
+}
+
+MD_String8 image_id(MD_String8 name) {
+    assert(is_image_reference(name), MD_S8Fmt(cg_arena, "No image named '%.*s', images must come before what uses them", MD_S8VArg(name)));
+    return MD_S8Fmt(cg_arena, "IMAGE_%.*s", MD_S8VArg(upper(MD_S8Skip(name, MD_S8Lit("image_").size))));
+}
+
+// a single value in an mdesk property as C. Decimals become floats, images become their
+// ImageId and other names, like of sprites, become pointers to them. Negative numbers
+// aren't supported
+MD_String8 c_literal(MD_Node *value) {
+    if(value->flags & MD_NodeFlag_Numeric) {
+        if(has_decimal(value->string)) return MD_S8Fmt(cg_arena, "%.*sf", MD_S8VArg(value->string));
+        return value->string;
+    }
+    if(MD_S8Match(value->string, MD_S8Lit("true"), 0) || MD_S8Match(value->string, MD_S8Lit("false"), 0)) return value->string;
+    assert(value->flags & MD_NodeFlag_Identifier, MD_S8Fmt(cg_arena, "Don't know how to turn '%.*s' into C", MD_S8VArg(value->string)));
+    if(is_image_reference(value->string)) return image_id(value->string);
+    return MD_S8Fmt(cg_arena, "&%.*s", MD_S8VArg(value->string));
+}
+
+// `name: value` as a designated initializer, lists in braces stay lists
+MD_String8 c_initializer(MD_Node *property) {
+    MD_String8 value = {0};
+    if(property->flags & MD_NodeFlag_HasBraceLeft) {
+        MD_String8List elements = {0};
+        for(MD_EachNode(element, property->first_child)) {
+            MD_S8ListPush(cg_arena, &elements, c_literal(element));
+        }
+        MD_StringJoin join = { .mid = MD_S8Lit(", ") };
+        value = MD_S8Fmt(cg_arena, "{ %.*s }", MD_S8VArg(MD_S8ListJoin(cg_arena, elements, &join)));
+    } else {
+        assert(!MD_NodeIsNil(property->first_child) && MD_NodeIsNil(property->first_child->next), MD_S8Fmt(cg_arena, "Property '%.*s' must have exactly one value", MD_S8VArg(property->string)));
+        value = c_literal(property->first_child);
+    }
+    return MD_S8Fmt(cg_arena, ".%.*s = %.*s,\n", MD_S8VArg(property->string), MD_S8VArg(value));
+}
+
+MD_String8List entity_kinds = {0}; // upper case, without the ENTITY_ in front
+
+bool is_entity_kind(MD_String8 name) {
+    for(MD_String8Node *kind = entity_kinds.first; kind != NULL; kind = kind->next) {
+        if(MD_S8Match(kind->string, name, 0)) return true;
+    }
+    return false;
+}
+
+// its value in the generated EntityKind enum
+uint32_t entity_kind_value(MD_String8 name) {
+    uint32_t value = 1; // after ENTITY_INVALID
+    for(MD_String8Node *kind = entity_kinds.first; kind != NULL; kind = kind->next) {
+        if(MD_S8Match(kind->string, name, 0)) return value;
+        value += 1;
+    }
+    assert(false, MD_S8Fmt(cg_arena, "No entity kind '%.*s'", MD_S8VArg(name)));
+    return 0;
+}
+
+void write_u32(uint8_t *at, uint32_t value) {
+    memcpy(at, &value, sizeof(value));
+}
+
+// writes the level in the format of level_format.h, tiles run length encoded a chunk
+// at a time. Tiles are row after row, width by height
+void bake_level(MD_String8 path, int width, int height, uint16_t *tiles, uint64_t *solid, LevelFileEntity *entities, int num_entities) {
+    int words_per_row = (width + 63)/64;
+    int chunks_wide = (width + LEVEL_CHUNK_TILES - 1)/LEVEL_CHUNK_TILES;
+    int chunks_high = (height + LEVEL_CHUNK_TILES - 1)/LEVEL_CHUNK_TILES;
+    int num_chunks = chunks_wide*chunks_high;
+
+    LevelFileHeader header = {
+        .magic = LEVEL_FILE_MAGIC,
+        .version = LEVEL_FILE_VERSION,
+        .chunk_tiles = LEVEL_CHUNK_TILES,
+        .width = width,
+        .height = height,
+        .num_entities = num_entities,
+    };
+    size_t size = sizeof(header);
+    header.entities_offset = (uint32_t)size;
+    size += num_entities*sizeof(LevelFileEntity);
+    size = (size + 7) & ~(size_t)7;
+    header.solid_offset = (uint32_t)size;
+    size += words_per_row*height*sizeof(uint64_t);
+    header.chunks_offset = (uint32_t)size;
+    size += (num_chunks + 1)*sizeof(uint32_t);
+
+    // at worst every tile is a run of its own
+    size_t max_size = size + (size_t)num_chunks*LEVEL_CHUNK_TILES*LEVEL_CHUNK_TILES*sizeof(LevelFileRun);
+    uint8_t *out = calloc(max_size, 1);
+    memcpy(out + header.entities_offset, entities, num_entities*sizeof(LevelFileEntity));
+    memcpy(out + header.solid_offset, solid, words_per_row*height*sizeof(uint64_t));
+    for(int chunk = 0; chunk < num_chunks; chunk++) {
+        write_u32(out + header.chunks_offset + chunk*sizeof(uint32_t), (uint32_t)size);
+        int chunk_x = (chunk % chunks_wide)*LEVEL_CHUNK_TILES;
+        int chunk_y = (chunk / chunks_wide)*LEVEL_CHUNK_TILES;
+        LevelFileRun run = {0};
+        for(int i = 0; i < LEVEL_CHUNK_TILES*LEVEL_CHUNK_TILES; i++) {
+            int x = chunk_x + i % LEVEL_CHUNK_TILES;
+            int y = chunk_y + i / LEVEL_CHUNK_TILES;
+            uint16_t kind = x < width && y < height ? tiles[y*width + x] : 0;
+            if(run.count > 0 && (run.kind != kind || run.count == UINT16_MAX)) {
+                memcpy(out + size, &run, sizeof(run));
+                size += sizeof(run);
+                run.count = 0;
+            }
+            run.kind = kind;
+            run.count += 1;
+        }
+        memcpy(out + size, &run, sizeof(run));
+        size += sizeof(run);
+    }
+    write_u32(out + header.chunks_offset + num_chunks*sizeof(uint32_t), (uint32_t)size);
+    header.size = (uint32_t)size;
+    memcpy(out, &header, sizeof(header));
+
+    char *path_nulled = nullterm(path);
+    FILE *file = fopen(path_nulled, "wb");
+    assert(file, MD_S8Fmt(cg_arena, "Could not write %.*s, does %.*s exist?", MD_S8VArg(path), MD_S8VArg(BAKED_FOLDER)));
+    free(path_nulled);
+    fwrite(out, 1, size, file);
+    fclose(file);
+    log("Baked %.*s, %d by %d tiles in %zu bytes\n", MD_S8VArg(path), width, height, size);
+    free(out);
+}
+
+typedef struct LevelBake {
+    MD_String8 name;
+    MD_String8 json_path;
+    MD_String8 baked_path;
+    ParsedTileset *tileset;
+} LevelBake;
+
+// reads the level tiled made and bakes it. Runs on any thread, so it has an arena of its own
+void bake_level_from_json(LevelBake *bake) {
+    MD_Arena *arena = MD_ArenaAlloc();
+    MD_ParseResult level_parse = MD_ParseWholeFile(arena, bake->json_path);
+    assert(!MD_NodeIsNil(level_parse.node->first_child), MD_S8Lit("Failed to load level file"));
+
+    MD_Node *layers = MD_ChildFromString(level_parse.node->first_child, MD_S8Lit("layers"), 0);
+    LevelFileEntity *entities = calloc(MAX_LEVEL_ENTITIES, sizeof(LevelFileEntity));
+    int num_entities = 0;
+    int width = 0;
+    int height = 0;
+    uint16_t *tiles = NULL;
+    uint64_t *solid = NULL;
+    for(MD_EachNode(lay, layers->first_child)) {
+        MD_String8 type = MD_ChildFromString(lay, MD_S8Lit("type"), 0)->first_child->string;
+        if(MD_S8Match(type, MD_S8Lit("objectgroup"), 0)) {
+            for(MD_EachNode(object, MD_ChildFromString(lay, MD_S8Lit("objects"), 0)->first_child)) {
+                // negative numbers for object position aren't supported here
+                MD_String8 name = MD_ChildFromString(object, MD_S8Lit("name"), 0)->first_child->string;
+                char *x_string = nullterm(MD_ChildFromString(object, MD_S8Lit("x"), 0)->first_child->string);
+                char *y_string = nullterm(MD_ChildFromString(object, MD_S8Lit("y"), 0)->first_child->string);
+                assert(is_entity_kind(name), MD_S8Fmt(cg_arena, "Level %.*s has an object named '%.*s', which isn't an @entity. Entities must come before the levels that use them", MD_S8VArg(bake->name), MD_S8VArg(name)));
+                assert(num_entities < MAX_LEVEL_ENTITIES, MD_S8Fmt(cg_arena, "Level %.*s has more than %d entities", MD_S8VArg(bake->name), MAX_LEVEL_ENTITIES));
+
+                entities[num_entities++] = (LevelFileEntity){
+                    .kind = entity_kind_value(name),
+                    .x = (float)atof(x_string),
+                    .y = -(float)atof(y_string),
+                };
+                free(x_string);
+                free(y_string);
+            }
+        }
+        if(MD_S8Match(type, MD_S8Lit("tilelayer"), 0)) {
+            width = (int)MD_CStyleIntFromString(MD_ChildFromString(layers->first_child, MD_S8Lit("width"), 0)->first_child->string);
+            height = (int)MD_CStyleIntFromString(MD_ChildFromString(layers->first_child, MD_S8Lit("height"), 0)->first_child->string);
+            MD_Node *data = MD_ChildFromString(layers->first_child, MD_S8Lit("data"), 0);
+
+            ParsedTileset *tileset = bake->tileset;
+            int words_per_row = (width + 63)/64;
+            solid = calloc(words_per_row*height, sizeof(uint64_t));
+            tiles = calloc(width*height, sizeof(uint16_t));
+
+            int num_index = 0;
+            for(MD_EachNode(tile_id_node, data->first_child)) {
+                assert(num_index < width*height, MD_S8Fmt(cg_arena, "Level %.*s has more than %dx%d tiles", MD_S8VArg(bake->name), width, height));
+                // gid 0 is no tile at all, which is solid just like outside the level
+                int gid = (int)MD_CStyleIntFromString(tile_id_node->string);
+                assert(gid >= 0 && gid <= UINT16_MAX, MD_S8Fmt(cg_arena, "Tile %d in level %.*s doesn't fit in a TileInstance", gid, MD_S8VArg(bake->name)));
+                tiles[num_index] = (uint16_t)gid;
+                bool is_solid = gid == 0 || (gid - 1 < tileset->tile_count && (tileset->flags[gid - 1] & TILE_SOLID));
+                int row = num_index / width;
+                int col = num_index % width;
+                if(is_solid) solid[row*words_per_row + col/64] |= 1ull << (col % 64);
+                num_index += 1;
+            }
+            assert(num_index == width*height, MD_S8Fmt(cg_arena, "Level %.*s has %d tiles, not %dx%d", MD_S8VArg(bake->name), num_index, width, height));
+        }
+    }
+    assert(tiles != NULL, MD_S8Fmt(cg_arena, "Level %.*s has no tile layer", MD_S8VArg(bake->name)));
+
+    bake_level(bake->baked_path, width, height, tiles, solid, entities, num_entities);
+    free(entities);
+    free(tiles);
+    free(solid);
+    MD_ArenaRelease(arena);
+}
+
+// codegen only makes the outputs whose inputs changed since last time. The manifest
+// has a hash of everything each output was made from, that's compared to a hash of
+// what it'd be made from now. The small generated C files are always made, they're
+// only written if they're different
+#define FNV_OFFSET 0xcbf29ce484222325ull
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t hash_string(uint64_t hash, MD_String8 s) {
+    hash = hash_bytes(hash, &s.size, sizeof(s.size)); // so "ab" "c" and "a" "bc" hash differently
+    return hash_bytes(hash, s.str, s.size);
+}
 
+uint64_t hash_file(uint64_t hash, MD_String8 path) {
+    MD_String8 contents = MD_LoadEntireFile(cg_arena, path);
+    assert(contents.str != NULL, MD_S8Fmt(cg_arena, "Could not read %.*s", MD_S8VArg(path)));
+    hash = hash_string(hash, path);
+    return hash_string(hash, contents);
+}
+
+typedef struct ManifestEntry {
+    MD_String8 output;
+    uint64_t inputs_hash;
+} ManifestEntry;
+
+#define MAX_MANIFEST_ENTRIES 256
+ManifestEntry old_manifest[MAX_MANIFEST_ENTRIES] = {0};
+int old_manifest_count = 0;
+ManifestEntry new_manifest[MAX_MANIFEST_ENTRIES] = {0};
+int new_manifest_count = 0;
+
+MD_String8 manifest_path(void) {
+    return MD_S8Fmt(cg_arena, "%.*s/manifest.txt", MD_S8VArg(OUTPUT_FOLDER));
+}
+
+// a line of `hash output` per output
+void load_manifest(void) {
+    MD_String8 contents = MD_LoadEntireFile(cg_arena, manifest_path());
+    MD_String8 newline = MD_S8Lit("\n");
+    MD_String8List lines = MD_S8Split(cg_arena, contents, 1, &newline);
+    for(MD_String8Node *line = lines.first; line != NULL; line = line->next) {
+        MD_String8 text = MD_S8ChopWhitespace(line->string);
+        if(text.size < 18 || old_manifest_count >= MAX_MANIFEST_ENTRIES) continue;
+        old_manifest[old_manifest_count++] = (ManifestEntry){
+            .output = MD_S8Skip(text, 17),
+            .inputs_hash = MD_U64FromString(MD_S8Prefix(text, 16), 16),
+        };
+    }
+}
+
+void save_manifest(void) {
+    FILE *file = fopen(nullterm(manifest_path()), "wb");
+    assert(file, MD_S8Lit("Could not write the codegen manifest"));
+    for(int i = 0; i < new_manifest_count; i++) {
+        fprintf(file, "%016llx %.*s\n", (unsigned long long)new_manifest[i].inputs_hash, MD_S8VArg(new_manifest[i].output));
+    }
+    fclose(file);
+}
+
+// records what the output is made from, and if it's made from the same things as last
+// time and is still there then it doesn't need making again
+bool up_to_date(MD_String8 output, uint64_t inputs_hash) {
+    assert(new_manifest_count < MAX_MANIFEST_ENTRIES, MD_S8Lit("Too many codegen outputs for the manifest"));
+    new_manifest[new_manifest_count++] = (ManifestEntry){ .output = output, .inputs_hash = inputs_hash };
+    for(int i = 0; i < old_manifest_count; i++) {
+        if(!MD_S8Match(old_manifest[i].output, output, 0)) continue;
+        if(old_manifest[i].inputs_hash != inputs_hash) return false;
+        FILE *existing = fopen(nullterm(output), "rb");
+        if(existing == NULL) return false;
+        fclose(existing);
+        return true;
+    }
+    return false;
+}
+
+void write_if_changed(MD_String8 path, MD_String8 contents) {
+    MD_String8 existing = MD_LoadEntireFile(cg_arena, path);
+    if(existing.str != NULL && MD_S8Match(existing, contents, 0)) return;
+    log("Writing to %.*s\n", MD_S8VArg(path));
+    FILE *file = fopen(nullterm(path), "wb");
+    assert(file, MD_S8Fmt(cg_arena, "Could not write %.*s", MD_S8VArg(path)));
+    fwrite(contents.str, 1, contents.size, file);
+    fclose(file);
+}
+
+// the slow parts, which don't depend on each other, are run across all the cores
+typedef struct Task {
+    void (*proc)(void *arg);
+    void *arg;
+} Task;
+
+#define MAX_TASKS 256
+Task tasks[MAX_TASKS] = {0};
+int num_tasks = 0;
+
+void add_task(void (*proc)(void *arg), void *arg) {
+    assert(num_tasks < MAX_TASKS, MD_S8Lit("Too many codegen tasks"));
+    tasks[num_tasks++] = (Task){ .proc = proc, .arg = arg };
+}
+
+void run_tasks_job(void *data, int from, int to) {
+    Task *to_run = data;
+    for(int i = from; i < to; i++) to_run[i].proc(to_run[i].arg);
+}
+
+void bake_level_task(void *arg) {
+    bake_level_from_json(arg);
+}
+
+typedef struct ImageBake {
+    MD_String8 path;
+    int width;
+    int height;
+    uint8_t *runs; // see image_pack_format.h
+    size_t runs_size;
+} ImageBake;
+
+#define MAX_IMAGES 128
+ImageBake image_bakes[MAX_IMAGES] = {0};
+int num_image_bakes = 0;
+
+// decodes the png and compresses it into runs of pixels, for the pack
+void bake_image_task(void *arg) {
+    ImageBake *bake = arg;
+    char *path = nullterm(bake->path);
+    int num_channels;
+    uint32_t *pixels = (uint32_t *)stbi_load(path, &bake->width, &bake->height, &num_channels, 4);
+    assert(pixels, MD_S8Fmt(cg_arena, "Could not decode image %.*s", MD_S8VArg(bake->path)));
+    free(path);
+
+    int num_pixels = bake->width*bake->height;
+    // at worst a header for every pixel
+    uint8_t *out = malloc(num_pixels*2*sizeof(uint32_t));
+    size_t size = 0;
+    int i = 0;
+    while(i < num_pixels) {
+        int repeats = 1;
+        while(i + repeats < num_pixels && pixels[i + repeats] == pixels[i]) repeats++;
+        uint32_t header;
+        if(repeats >= 3) {
+            header = IMAGE_PACK_REPEAT | (uint32_t)repeats;
+            memcpy(out + size, &header, sizeof(header));
+            memcpy(out + size + sizeof(header), &pixels[i], sizeof(uint32_t));
+            size += 2*sizeof(uint32_t);
+            i += repeats;
+            continue;
+        }
+        // literals until the next run worth repeating
+        int literals = 0;
+        while(i + literals < num_pixels) {
+            int at = i + literals;
+            if(at + 2 < num_pixels && pixels[at] == pixels[at + 1] && pixels[at] == pixels[at + 2]) break;
+            literals++;
+        }
+        header = (uint32_t)literals;
+        memcpy(out + size, &header, sizeof(header));
+        memcpy(out + size + sizeof(header), &pixels[i], literals*sizeof(uint32_t));
+        size += sizeof(header) + literals*sizeof(uint32_t);
+        i += literals;
+    }
+    stbi_image_free(pixels);
+    bake->runs = out;
+    bake->runs_size = size;
+}
+
+void write_image_pack(MD_String8 path, uint64_t ids_hash) {
+    ImagePackHeader header = {
+        .magic = IMAGE_PACK_MAGIC,
+        .version = IMAGE_PACK_VERSION,
+        .ids_hash = ids_hash,
+        .num_images = num_image_bakes,
+    };
+    size_t size = sizeof(header) + num_image_bakes*sizeof(ImagePackEntry);
+    ImagePackEntry *entries = calloc(num_image_bakes, sizeof(ImagePackEntry));
+    for(int i = 0; i < num_image_bakes; i++) {
+        entries[i] = (ImagePackEntry){
+            .width = image_bakes[i].width,
+            .height = image_bakes[i].height,
+            .offset = (uint32_t)size,
+            .size = (uint32_t)image_bakes[i].runs_size,
+        };
+        size += image_bakes[i].runs_size;
+    }
+    header.size = (uint32_t)size;
+
+    FILE *file = fopen(nullterm(path), "wb");
+    assert(file, MD_S8Fmt(cg_arena, "Could not write %.*s, does %.*s exist?", MD_S8VArg(path), MD_S8VArg(BAKED_FOLDER)));
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries, sizeof(ImagePackEntry), num_image_bakes, file);
+    for(int i = 0; i < num_image_bakes; i++) fwrite(image_bakes[i].runs, 1, image_bakes[i].runs_size, file);
+    fclose(file);
+    log("Packed %d images into %.*s, %zu bytes\n", num_image_bakes, MD_S8VArg(path), size);
+    free(entries);
+}
+
+char *shader_command = NULL;
+void compile_shaders_task(void *arg) {
+    (void)arg;
+    log("Compiling shaders: %s\n", shader_command);
+    int result = system(shader_command);
+    assert(result == 0, MD_S8Lit("Compiling shaders failed"));
+}
+
+
+// codegen [--shdc path/to/sokol-shdc] compiles quad.glsl too when it's given the
+// shader compiler, which the headless build doesn't need
 int main(int argc, char **argv) {
     cg_arena = MD_ArenaAlloc();
     assert(cg_arena, MD_S8Lit("Memory"));
+    jobs_init(-1);
+
+    char *shdc_path = NULL;
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--shdc") == 0) shdc_path = argv[++i];
+    }
 
-    char *nulled = nullterm(MD_S8Lit("test"));
+    load_manifest();
+    // a change to how things are generated changes everything
+    uint64_t codegen_hash = hash_file(FNV_OFFSET, MD_S8Lit("codegen.c"));
+    codegen_hash = hash_file(codegen_hash, MD_S8Lit("level_format.h"));
 
-    // I hope to God MD_String8's are null terminated...
-    MD_String8 writeto = MD_S8Fmt(cg_arena, "%.*s/assets.gen.c", MD_S8VArg(OUTPUT_FOLDER));
-    log("Writing to %.*s\n", MD_S8VArg(writeto));
-    FILE *output = fopen(writeto.str, "w");
+    // everything but the images goes in sim.gen.c, so the simulation can be built without
+    // sokol_gfx. The images are decoded into a pack main.c loads
+    MD_String8 writeto = MD_S8Fmt(cg_arena, "%.*s/sim.gen.c", MD_S8VArg(OUTPUT_FOLDER));
+    MD_String8List output = {0};
 
     MD_ParseResult parse = MD_ParseWholeFile(cg_arena, MD_S8Lit("assets.mdesk"));
+    MD_String8 placeholder_path = {0};
 
     //dump(parse.node);
 
-    MD_String8List declarations_list = {0};
-    MD_String8List load_list = {0};
     MD_String8List level_decl_list = {0};
     MD_String8List tileset_decls = {0};
+    MD_String8List tile_flag_decls = {0};
+    MD_String8List sprite_decls = {0};
+    MD_String8List archetype_decls = {0};
     for(MD_EachNode(node, parse.node->first_child)) {
         if(MD_S8Match(node->first_tag->string, MD_S8Lit("image"), 0)) {
-            MD_String8 variable_name = MD_S8Fmt(cg_arena, "image_%.*s", MD_S8VArg(node->string));
-            log("New image variable %.*s\n", MD_S8VArg(variable_name));
+            MD_String8 variable_name = MD_S8Fmt(cg_arena, "IMAGE_%.*s", MD_S8VArg(upper(node->string)));
+            log("New image %.*s\n", MD_S8VArg(variable_name));
             MD_String8 filepath = ChildValue(node, MD_S8Lit("filepath"));
             filepath = asset_file_path(filepath);
             assert(filepath.str != 0, MD_S8Fmt(cg_arena, "No filepath specified for image '%.*s'", MD_S8VArg(node->string)));
@@ -134,8 +613,33 @@ int main(int argc, char **argv) {
             assert(asset_file, MD_S8Fmt(cg_arena, "Could not open filepath %.*s for asset '%.*s'", MD_S8VArg(filepath), MD_S8VArg(node->string)));
             fclose(asset_file);
 
-            MD_S8ListPush(cg_arena, &declarations_list, MD_S8Fmt(cg_arena, "sg_image %.*s = {0};\n", MD_S8VArg(variable_name)));
-            MD_S8ListPush(cg_arena, &load_list, MD_S8Fmt(cg_arena, "%.*s = load_image(\"%.*s\");\n", MD_S8VArg(variable_name), MD_S8VArg(filepath)));
+            assert(!is_image_reference(MD_S8Fmt(cg_arena, "image_%.*s", MD_S8VArg(node->string))), MD_S8Fmt(cg_arena, "Image %.*s declared twice", MD_S8VArg(node->string)));
+            MD_S8ListPush(cg_arena, &image_names, upper(node->string));
+            assert(num_image_bakes < MAX_IMAGES, MD_S8Lit("Too many images"));
+            if(!MD_NodeIsNil(MD_ChildFromString(node, MD_S8Lit("placeholder"), 0))) {
+                assert(placeholder_path.size == 0, MD_S8Fmt(cg_arena, "Image %.*s is the second placeholder, there can only be one", MD_S8VArg(node->string)));
+                placeholder_path = filepath;
+            }
+            image_bakes[num_image_bakes++] = (ImageBake){ .path = filepath };
+        }
+        if(MD_S8Match(node->first_tag->string, MD_S8Lit("sprite"), 0)) {
+            log("New sprite %.*s\n", MD_S8VArg(node->string));
+            list_printf(&sprite_decls, "AnimatedSprite %.*s = {\n", MD_S8VArg(node->string));
+            for(MD_EachNode(property, node->first_child)) {
+                MD_S8ListPush(cg_arena, &sprite_decls, c_initializer(property));
+            }
+            list_printf(&sprite_decls, "};\n");
+        }
+        if(MD_S8Match(node->first_tag->string, MD_S8Lit("entity"), 0)) {
+            MD_String8 kind = upper(node->string);
+            log("New entity ENTITY_%.*s\n", MD_S8VArg(kind));
+            assert(!is_entity_kind(kind), MD_S8Fmt(cg_arena, "Entity %.*s declared twice", MD_S8VArg(node->string)));
+            MD_S8ListPush(cg_arena, &entity_kinds, kind);
+            list_printf(&archetype_decls, "[ENTITY_%.*s] = {\n", MD_S8VArg(kind));
+            for(MD_EachNode(property, node->first_child)) {
+                MD_S8ListPush(cg_arena, &archetype_decls, c_initializer(property));
+            }
+            list_printf(&archetype_decls, "},\n");
         }
         if(MD_S8Match(node->first_tag->string, MD_S8Lit("tileset"), 0)) {
             MD_String8 variable_name = MD_S8Fmt(cg_arena, "tileset_%.*s", MD_S8VArg(node->string));
@@ -144,97 +648,189 @@ int main(int argc, char **argv) {
 
             MD_String8 tileset_file_contents = MD_LoadEntireFile(cg_arena, filepath);
             list_printf(&tileset_decls, "TileSet %.*s = {\n", MD_S8VArg(variable_name));
-            list_printf(&tileset_decls, ".img = &%.*s,\n", MD_S8VArg(ChildValue(node, MD_S8Lit("image"))));
+            list_printf(&tileset_decls, ".img = %.*s,\n", MD_S8VArg(image_id(ChildValue(node, MD_S8Lit("image")))));
+
+            int tile_count = 0;
+            {
+                char *tilecount_str = goto_end_of(tileset_file_contents.str, tileset_file_contents.size, "tilecount=\"");
+                assert(tilecount_str, MD_S8Fmt(cg_arena, "Tileset %.*s has no tilecount", MD_S8VArg(filepath)));
+                tile_count = atoi(tilecount_str);
+            }
+            uint8_t *flags = calloc(tile_count, 1);
+
+            // tiles tiled doesn't let you edit, like those from bought packs, can be marked solid here
+            MD_Node *solid_tiles = MD_ChildFromString(node, MD_S8Lit("solid_tiles"), 0);
+            for(MD_EachNode(solid_id, solid_tiles->first_child)) {
+                int id = atoi(nullterm(solid_id->string));
+                assert(id >= 0 && id < tile_count, MD_S8Fmt(cg_arena, "Solid tile id %d out of range for tileset %.*s", id, MD_S8VArg(node->string)));
+                flags[id] |= TILE_SOLID;
+            }
 
             list_printf(&tileset_decls, ".animated = {\n");
             char *end = tileset_file_contents.str + tileset_file_contents.size;
             char *cur = tileset_file_contents.str;
+            int num_animated = 0;
             while(cur < end) {
                 cur = goto_end_of(cur, end - cur, "<tile id=\""); 
                 if(cur == NULL) break;
                 char *new_cur = fillnull(cur, '"');
-                int frame_from = atoi(cur);
+                int tile_id = atoi(cur);
                 cur = new_cur;
-                list_printf(&tileset_decls, "{ .id_from = %d, .frames = { ", frame_from);
+                assert(tile_id >= 0 && tile_id < tile_count, MD_S8Lit("Tile id out of range of tilecount"));
 
-                char *end_of_anim = goto_end_of(cur, end - cur, "</animation>");
+                // everything about this tile is before its closing tag, or the next tile if it's self closing
+                char *end_of_tile = goto_end_of(cur, end - cur, "</tile>");
+                char *next_tile = goto_end_of(cur, end - cur, "<tile id=\"");
+                if(end_of_tile == NULL || (next_tile != NULL && next_tile < end_of_tile)) end_of_tile = next_tile ? next_tile : end;
+
+                char *solid_property = goto_end_of(cur, end_of_tile - cur, "name=\"solid\"");
+                if(solid_property != NULL) {
+                    char *value = goto_end_of(solid_property, end_of_tile - solid_property, "value=\"");
+                    if(value != NULL && strncmp(value, "true", 4) == 0) flags[tile_id] |= TILE_SOLID;
+                }
+                // collision shapes drawn in tiled's tile collision editor. Still collide as full tiles
+                if(goto_end_of(cur, end_of_tile - cur, "<objectgroup") != NULL) {
+                    flags[tile_id] |= TILE_SOLID | TILE_COLLISION_SHAPE;
+                }
 
                 int num_frames = 0;
+                MD_String8List frames = {0};
                 while(true) {
                     char *next_frame = goto_end_of(cur, end - cur, "<frame tileid=\"");
-                    if(next_frame == NULL || next_frame > end_of_anim) break;
+                    if(next_frame == NULL || next_frame > end_of_tile) break;
                     char *new_cur = fillnull(next_frame, '"');
                     int frame = atoi(next_frame);
                         
-                    list_printf(&tileset_decls, "%d, ", frame);
+                    list_printf(&frames, "%d, ", frame);
                     num_frames++;
 
                     cur = new_cur;
                 }
-                list_printf(&tileset_decls, "}, .num_frames = %d },\n", num_frames);
+                if(num_frames > 0) {
+                    MD_StringJoin join = MD_ZERO_STRUCT;
+                    list_printf(&tileset_decls, "{ .id_from = %d, .frames = { %.*s}, .num_frames = %d },\n", tile_id, MD_S8VArg(MD_S8ListJoin(cg_arena, frames, &join)), num_frames);
+                    num_animated++;
+                    assert(num_animated <= 128, MD_S8Lit("Too many animated tiles for TileSet.animated"));
+                }
             }
-            list_printf(&tileset_decls, "}};\n");
+            list_printf(&tileset_decls, "},\n");
+
+            list_printf(&tileset_decls, ".num_tiles = %d,\n", tile_count);
+            list_printf(&tileset_decls, ".flags = %.*s_flags,\n", MD_S8VArg(variable_name));
+            list_printf(&tile_flag_decls, "uint8_t %.*s_flags[%d] = {\n", MD_S8VArg(variable_name), tile_count);
+            for(int i = 0; i < tile_count; i++) {
+                if(flags[i] == 0) continue;
+                MD_String8List names = {0};
+                if(flags[i] & TILE_SOLID) MD_S8ListPush(cg_arena, &names, MD_S8Lit("TILE_SOLID"));
+                if(flags[i] & TILE_COLLISION_SHAPE) MD_S8ListPush(cg_arena, &names, MD_S8Lit("TILE_COLLISION_SHAPE"));
+                MD_StringJoin join = { .mid = MD_S8Lit(" | ") };
+                list_printf(&tile_flag_decls, "[%d] = %.*s,\n", i, MD_S8VArg(MD_S8ListJoin(cg_arena, names, &join)));
+            }
+            list_printf(&tile_flag_decls, "};\n");
+            list_printf(&tileset_decls, "};\n");
+
+            assert(num_tilesets < ARRLEN(tilesets), MD_S8Lit("Too many tilesets"));
+            tilesets[num_tilesets++] = (ParsedTileset){ .name = node->string, .flags = flags, .tile_count = tile_count };
         }
         if(MD_S8Match(node->first_tag->string, MD_S8Lit("level"), 0)) {
             MD_String8 variable_name = MD_S8Fmt(cg_arena, "level_%.*s", MD_S8VArg(node->string));
             log("New level variable %.*s\n", MD_S8VArg(variable_name));
-            MD_String8 filepath = asset_file_path(ChildValue(node, MD_S8Lit("filepath")));
-            MD_ParseResult level_parse = MD_ParseWholeFile(cg_arena, filepath);
-            assert(!MD_NodeIsNil(level_parse.node->first_child), MD_S8Lit("Failed to load level file"));
-
-            MD_Node *layers = MD_ChildFromString(level_parse.node->first_child, MD_S8Lit("layers"), 0);
-            fprintf(output, "Level %.*s = {\n", MD_S8VArg(variable_name));
-            for(MD_EachNode(lay, layers->first_child)) {
-                MD_String8 type = MD_ChildFromString(lay, MD_S8Lit("type"), 0)->first_child->string;
-                if(MD_S8Match(type, MD_S8Lit("objectgroup"), 0)) {
-                    fprintf(output, ".initial_entities = {\n");
-                    for(MD_EachNode(object, MD_ChildFromString(lay, MD_S8Lit("objects"), 0)->first_child)) {
-                        dump(object);
-                        // negative numbers for object position aren't supported here
-                        MD_String8 name = MD_ChildFromString(object, MD_S8Lit("name"), 0)->first_child->string;
-                        MD_String8 x_string = MD_ChildFromString(object, MD_S8Lit("x"), 0)->first_child->string;
-                        MD_String8 y_string = MD_ChildFromString(object, MD_S8Lit("y"), 0)->first_child->string;
-                        y_string = MD_S8Fmt(cg_arena, "-%.*s", MD_S8VArg(y_string));
-
-                        if(has_decimal(x_string)) x_string = MD_S8Fmt(cg_arena, "%.*sf", MD_S8VArg(x_string));
-                        if(has_decimal(y_string)) y_string = MD_S8Fmt(cg_arena, "%.*sf", MD_S8VArg(y_string));
-
-                        fprintf(output, "{ .exists = true, .kind = ENTITY_%.*s, .pos = { .X=%.*s, .Y=%.*s }, }, ", MD_S8VArg(name), MD_S8VArg(x_string), MD_S8VArg(y_string));
-                    }
-                    fprintf(output, "\n}, // entities\n");
-                }
-                if(MD_S8Match(type, MD_S8Lit("tilelayer"), 0)) {
-                    int width = atoi(nullterm(MD_ChildFromString(layers->first_child, MD_S8Lit("width"), 0)->first_child->string));
-                    int height = atoi(nullterm(MD_ChildFromString(layers->first_child, MD_S8Lit("height"), 0)->first_child->string));
-                    MD_Node *data = MD_ChildFromString(layers->first_child, MD_S8Lit("data"), 0);
-
-                    int num_index = 0;
-                    fprintf(output, ".tiles = {\n");
-                    fprintf(output, "{ ");
-                    for(MD_EachNode(tile_id_node, data->first_child)) {
-                        fprintf(output, "%.*s, ", MD_S8VArg(tile_id_node->string));
-
-                        if(num_index % width == width - 1) {
-                            if(MD_NodeIsNil(tile_id_node->next)) {
-                                fprintf(output, "},\n},\n");
-                            } else {
-                                fprintf(output, "},\n{ ");
-                            }
-                        }
-                        num_index += 1;
-                    }
-                }
+            LevelBake *bake = MD_PushArrayZero(cg_arena, LevelBake, 1);
+            bake->name = node->string;
+            bake->json_path = asset_file_path(ChildValue(node, MD_S8Lit("filepath")));
+            bake->baked_path = MD_S8Fmt(cg_arena, "%.*s/%.*s.level", MD_S8VArg(BAKED_FOLDER), MD_S8VArg(node->string));
+            bake->tileset = find_tileset(ChildValue(node, MD_S8Lit("tileset")));
+
+            // baked into a file of its own, so the level's size doesn't affect the build.
+            // Depends on the entity kinds, for their numbers, and which tiles are solid
+            uint64_t inputs_hash = hash_file(codegen_hash, bake->json_path);
+            inputs_hash = hash_bytes(inputs_hash, bake->tileset->flags, bake->tileset->tile_count);
+            for(MD_String8Node *kind = entity_kinds.first; kind != NULL; kind = kind->next) inputs_hash = hash_string(inputs_hash, kind->string);
+            if(up_to_date(bake->baked_path, inputs_hash)) {
+                log("%.*s is up to date\n", MD_S8VArg(bake->baked_path));
+            } else {
+                add_task(bake_level_task, bake);
             }
-            fprintf(output, "\n}; // %.*s\n", MD_S8VArg(variable_name));
+            list_printf(&output, "Level %.*s = { .filepath = \"%.*s\" };\n", MD_S8VArg(variable_name), MD_S8VArg(bake->baked_path));
+        }
+    }
+
+    // the images are in the pack in ImageId order, so it goes with the ids it was made with
+    uint64_t ids_hash = FNV_OFFSET;
+    for(MD_String8Node *image = image_names.first; image != NULL; image = image->next) ids_hash = hash_string(ids_hash, image->string);
+    MD_String8 pack_path = MD_S8Fmt(cg_arena, "%.*s/images.pack", MD_S8VArg(BAKED_FOLDER));
+    uint64_t pack_inputs_hash = hash_bytes(codegen_hash, &ids_hash, sizeof(ids_hash));
+    pack_inputs_hash = hash_file(pack_inputs_hash, MD_S8Lit("image_pack_format.h")); // only the pack, levels don't use it
+    for(int i = 0; i < num_image_bakes; i++) pack_inputs_hash = hash_file(pack_inputs_hash, image_bakes[i].path);
+    bool pack_up_to_date = up_to_date(pack_path, pack_inputs_hash);
+    if(pack_up_to_date) {
+        log("%.*s is up to date\n", MD_S8VArg(pack_path));
+    } else {
+        for(int i = 0; i < num_image_bakes; i++) add_task(bake_image_task, &image_bakes[i]);
+    }
+
+    if(shdc_path != NULL) {
+        MD_String8 shader_path = MD_S8Lit("quad.glsl");
+        MD_String8 shader_output = MD_S8Fmt(cg_arena, "%.*s/quad-sapp.glsl.h", MD_S8VArg(OUTPUT_FOLDER));
+        shader_command = nullterm(MD_S8Fmt(cg_arena, "\"%s\" --input %.*s --output %.*s --slang glsl100:hlsl5:metal_macos", shdc_path, MD_S8VArg(shader_path), MD_S8VArg(shader_output)));
+        uint64_t inputs_hash = hash_file(FNV_OFFSET, shader_path);
+        inputs_hash = hash_string(inputs_hash, MD_S8CString(shader_command));
+        if(up_to_date(shader_output, inputs_hash)) {
+            log("%.*s is up to date\n", MD_S8VArg(shader_output));
+        } else {
+            add_task(compile_shaders_task, NULL);
         }
     }
+    parallel_for(num_tasks, 1, run_tasks_job, tasks);
+    if(!pack_up_to_date) write_image_pack(pack_path, ids_hash);
 
     MD_StringJoin join = MD_ZERO_STRUCT;
-    MD_String8 declarations = MD_S8ListJoin(cg_arena, declarations_list, &join);
-    MD_String8 loads = MD_S8ListJoin(cg_arena, load_list, &join);
-    fprintf(output, "%.*s\nvoid load_assets() {\n%.*s\n}\n", MD_S8VArg(declarations), MD_S8VArg(loads));
-    fprintf(output, "%.*s\n", MD_S8VArg(MD_S8ListJoin(cg_arena, tileset_decls, &join)));
+    list_printf(&output, "%.*s\n", MD_S8VArg(MD_S8ListJoin(cg_arena, sprite_decls, &join)));
+    list_printf(&output, "const EntityArchetype archetypes[ENTITY_LAST] = {\n%.*s};\n", MD_S8VArg(MD_S8ListJoin(cg_arena, archetype_decls, &join)));
+    list_printf(&output, "%.*s\n", MD_S8VArg(MD_S8ListJoin(cg_arena, tile_flag_decls, &join)));
+    list_printf(&output, "%.*s\n", MD_S8VArg(MD_S8ListJoin(cg_arena, tileset_decls, &join)));
+    write_if_changed(writeto, MD_S8ListJoin(cg_arena, output, &join));
+
+    MD_String8 images_path = MD_S8Fmt(cg_arena, "%.*s/image_ids.gen.h", MD_S8VArg(OUTPUT_FOLDER));
+    MD_String8List image_ids = {0};
+    list_printf(&image_ids, "typedef enum ImageId {\nIMAGE_INVALID, // zero initialized is no image\n");
+    for(MD_String8Node *image = image_names.first; image != NULL; image = image->next) {
+        list_printf(&image_ids, "IMAGE_%.*s,\n", MD_S8VArg(image->string));
+    }
+    list_printf(&image_ids, "IMAGE_LAST,\n} ImageId;\n");
+    list_printf(&image_ids, "#define IMAGE_IDS_HASH 0x%016llxull\n", (unsigned long long)ids_hash);
+    list_printf(&image_ids, "#define IMAGE_PACK_PATH \"%.*s\"\n", MD_S8VArg(pack_path));
+    write_if_changed(images_path, MD_S8ListJoin(cg_arena, image_ids, &join));
+
+    // the placeholder is built in, so it's there before the pack has loaded
+    assert(placeholder_path.size > 0, MD_S8Lit("One image needs to be the placeholder"));
+    {
+        int width, height, num_channels;
+        uint32_t *pixels = (uint32_t *)stbi_load(nullterm(placeholder_path), &width, &height, &num_channels, 4);
+        assert(pixels, MD_S8Fmt(cg_arena, "Could not decode image %.*s", MD_S8VArg(placeholder_path)));
+        MD_String8List placeholder = {0};
+        list_printf(&placeholder, "// %.*s, drawn until images have loaded\n", MD_S8VArg(placeholder_path));
+        list_printf(&placeholder, "#define PLACEHOLDER_IMAGE_WIDTH %d\n#define PLACEHOLDER_IMAGE_HEIGHT %d\n", width, height);
+        list_printf(&placeholder, "const uint32_t placeholder_image_pixels[%d] = {\n", width*height);
+        for(int i = 0; i < width*height; i++) {
+            list_printf(&placeholder, "0x%08x,%s", pixels[i], i % width == width - 1 ? "\n" : " ");
+        }
+        list_printf(&placeholder, "};\n");
+        stbi_image_free(pixels);
+        write_if_changed(MD_S8Fmt(cg_arena, "%.*s/placeholder_image.gen.h", MD_S8VArg(OUTPUT_FOLDER)), MD_S8ListJoin(cg_arena, placeholder, &join));
+    }
+
+    // included way before the rest, since entities are declared with it
+    MD_String8 kinds_path = MD_S8Fmt(cg_arena, "%.*s/entity_kinds.gen.h", MD_S8VArg(OUTPUT_FOLDER));
+    MD_String8List kinds = {0};
+    list_printf(&kinds, "typedef enum EntityKind {\nENTITY_INVALID, // zero initialized is invalid entity\n");
+    for(MD_String8Node *kind = entity_kinds.first; kind != NULL; kind = kind->next) {
+        list_printf(&kinds, "ENTITY_%.*s,\n", MD_S8VArg(kind->string));
+    }
+    list_printf(&kinds, "ENTITY_LAST,\n} EntityKind;\n");
+    write_if_changed(kinds_path, MD_S8ListJoin(cg_arena, kinds, &join));
 
-    fclose(output);
+    // only once everything's been made, so what failed is made again next time
+    save_manifest();
     return 0;
 }
@@ -0,0 +1,168 @@
+// runs the simulation with no window or gpu, as fast as it can. For benchmarks, soak
+// tests, and checking changes to the simulation don't change what it does
+//   headless [--ticks N] [--threads N] [--replay file] [--snapshots N] [--load file] [--save file]
+// --snapshots takes one every N ticks, delta encoded against the last, and times it.
+// Then goes back to one from halfway and runs again, the hash has to come out the same.
+// --load starts from a saved world instead of the level, --save writes it at the end
+// Without a recording the player walks in circles swinging, so old men get provoked
+// and there are projectiles flying around
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#include "sim.c"
+
+// goes and hits the closest old man that isn't shooting yet, then walks in circles
+// under fire rolling now and then. Only depends on the simulation, so it's the same
+// every run
+InputKeys scripted_input(uint64_t tick)
+{
+ Entity *player = get_entity(player_handle);
+ Entity *target = NULL;
+ float closest = INFINITY;
+ BUFF_ITER(OldMan, &old_men)
+ {
+  if(it->aggressive) continue;
+  Entity *e = &entities[it->entity];
+  float dist = LenV2(SubV2(e->pos, player->pos));
+  if(dist < closest)
+  {
+   closest = dist;
+   target = e;
+  }
+ }
+
+ InputKeys keys = 0;
+ if(target != NULL)
+ {
+  Vec2 to_target = SubV2(target->pos, player->pos);
+  if(to_target.X > 8.0f) keys |= INPUT_RIGHT;
+  if(to_target.X < -8.0f) keys |= INPUT_LEFT;
+  if(to_target.Y > 8.0f) keys |= INPUT_UP;
+  if(to_target.Y < -8.0f) keys |= INPUT_DOWN;
+  if(closest < 40.0f) keys |= INPUT_ATTACK;
+ }
+ else
+ {
+  const InputKeys directions[] = { INPUT_RIGHT, INPUT_RIGHT | INPUT_UP, INPUT_UP, INPUT_UP | INPUT_LEFT, INPUT_LEFT, INPUT_LEFT | INPUT_DOWN, INPUT_DOWN, INPUT_DOWN | INPUT_RIGHT };
+  keys = directions[(tick / TICK_RATE) % ARRLEN(directions)];
+  if(tick % (TICK_RATE*2) == 0) keys |= INPUT_ROLL;
+ }
+ return keys;
+}
+
+int main(int argc, char **argv)
+{
+ uint64_t ticks_to_run = TICK_RATE * 60 * 10; // ten minutes of play
+ int num_threads = 0; // counting this one, 0 for one per core
+ uint64_t snapshot_every = 0;
+ const char *load_path = NULL;
+ const char *save_path = NULL;
+ for(int i = 1; i + 1 < argc; i++)
+ {
+  if(strcmp(argv[i], "--ticks") == 0) ticks_to_run = strtoull(argv[++i], NULL, 10);
+  else if(strcmp(argv[i], "--threads") == 0) num_threads = atoi(argv[++i]);
+  else if(strcmp(argv[i], "--replay") == 0) replay_path = argv[++i];
+  else if(strcmp(argv[i], "--snapshots") == 0) snapshot_every = strtoull(argv[++i], NULL, 10);
+  else if(strcmp(argv[i], "--load") == 0) load_path = argv[++i];
+  else if(strcmp(argv[i], "--save") == 0) save_path = argv[++i];
+ }
+
+ stm_setup();
+ scratch = make_arena(1024 * 1024 * 8);
+ jobs_init(num_threads - 1);
+ reset_level();
+
+ if(replay_path != NULL)
+ {
+  replay();
+  return 0;
+ }
+ if(load_path != NULL && !read_snapshot_file(load_path))
+ {
+  fprintf(stderr, "Couldn't load %s\n", load_path);
+  return 1;
+ }
+
+ size_t snapshot_words = snapshot_size();
+ uint64_t *snapshot = NULL;
+ uint64_t *last_snapshot = NULL;
+ uint64_t *halfway = NULL;
+ uint64_t halfway_tick = 0;
+ uint8_t *encoded = NULL;
+ uint64_t *decoded = NULL;
+ int num_snapshots = 0;
+ double save_time = 0.0;
+ double encode_time = 0.0;
+ size_t encoded_bytes = 0;
+ if(snapshot_every > 0)
+ {
+  snapshot = malloc(snapshot_words*sizeof(uint64_t));
+  last_snapshot = malloc(snapshot_words*sizeof(uint64_t));
+  halfway = malloc(snapshot_words*sizeof(uint64_t));
+  encoded = malloc(max_encoded_snapshot_size(snapshot_words));
+  decoded = malloc(snapshot_words*sizeof(uint64_t));
+ }
+
+ uint64_t start = stm_now();
+ double snapshot_total = 0.0;
+ for(uint64_t i = 0; i < ticks_to_run; i++)
+ {
+  if(snapshot_every > 0 && i % snapshot_every == 0)
+  {
+   uint64_t snapshot_start = stm_now();
+   save_snapshot(snapshot);
+   uint64_t encode_start = stm_now();
+   size_t size = encode_snapshot(snapshot, num_snapshots > 0 ? last_snapshot : NULL, snapshot_words, encoded);
+   encode_time += stm_sec(stm_since(encode_start));
+   save_time += stm_sec(stm_diff(encode_start, snapshot_start));
+   encoded_bytes += size;
+
+   bool round_trip = decode_snapshot(encoded, size, num_snapshots > 0 ? last_snapshot : NULL, decoded, snapshot_words);
+   if(!round_trip || memcmp(decoded, snapshot, snapshot_words*sizeof(uint64_t)) != 0)
+   {
+    fprintf(stderr, "Snapshot at tick %llu DOESN'T decode back to itself\n", (unsigned long long)i);
+    return 1;
+   }
+   if(halfway_tick == 0 && i >= ticks_to_run/2)
+   {
+    memcpy(halfway, snapshot, snapshot_words*sizeof(uint64_t));
+    halfway_tick = i;
+   }
+   uint64_t *swap = last_snapshot;
+   last_snapshot = snapshot;
+   snapshot = swap;
+   num_snapshots++;
+   snapshot_total += stm_sec(stm_since(snapshot_start));
+  }
+  tick(input_from_keys(scripted_input(i)), (float)TICK_DT);
+  reset(&scratch);
+ }
+ double total = stm_sec(stm_since(start)) - snapshot_total;
+
+ printf("Ran %llu ticks in %.2f ms, %.0f ticks per second\n", (unsigned long long)ticks_to_run, total*1000.0, total > 0.0 ? ticks_to_run / total : 0.0);
+ for(int i = 0; i < PASS_LAST; i++) printf("%s: %.2f ms\n", pass_names[i], pass_times[i]*1000.0);
+ uint64_t hash = hash_sim_state();
+ printf("State hash %016llx\n", (unsigned long long)hash);
+ if(save_path != NULL && !write_snapshot_file(save_path))
+ {
+  fprintf(stderr, "Couldn't save %s\n", save_path);
+  return 1;
+ }
+
+ if(num_snapshots > 0)
+ {
+  printf("%d snapshots of %zu kb: save %.3f ms, encode %.3f ms, %.1f kb encoded on average\n", num_snapshots, snapshot_words*sizeof(uint64_t)/1024, save_time*1000.0/num_snapshots, encode_time*1000.0/num_snapshots, encoded_bytes/1024.0/num_snapshots);
+
+  uint64_t load_start = stm_now();
+  load_snapshot(halfway);
+  printf("Load %.3f ms\n", stm_ms(stm_since(load_start)));
+  for(uint64_t i = halfway_tick; i < ticks_to_run; i++)
+  {
+   tick(input_from_keys(scripted_input(i)), (float)TICK_DT);
+   reset(&scratch);
+  }
+  uint64_t rerun_hash = hash_sim_state();
+  printf("Rerun from tick %llu hash %016llx, %s\n", (unsigned long long)halfway_tick, (unsigned long long)rerun_hash, rerun_hash == hash ? "matches" : "DOESN'T MATCH");
+  if(rerun_hash != hash) return 1;
+ }
+ return 0;
+}
@@ -0,0 +1,30 @@
+// every image, decoded by codegen into assets/baked/images.pack so starting the game
+// doesn't decode any pngs. Included by both so they agree. Little endian, offsets
+// are from the start of the file
+#pragma once
+#include <stdint.h>
+
+#define IMAGE_PACK_MAGIC 0x4B415049 // "IPAK"
+#define IMAGE_PACK_VERSION 1 // bump when anything here changes, old packs won't load
+
+typedef struct ImagePackHeader
+{
+ uint32_t magic;
+ uint32_t version;
+ uint64_t ids_hash; // IMAGE_IDS_HASH of the image_ids.gen.h made with it, so they can't be mixed up
+ uint32_t num_images; // an ImagePackEntry each, in ImageId order starting after IMAGE_INVALID
+ uint32_t size; // of the whole file
+} ImagePackHeader;
+
+typedef struct ImagePackEntry
+{
+ uint32_t width;
+ uint32_t height;
+ uint32_t offset; // of its runs, which decode to width*height RGBA8 pixels, top row first
+ uint32_t size; // of its runs
+} ImagePackEntry;
+
+// pixel art is mostly runs of the same color, transparent especially. Runs start with
+// a uint32_t count of pixels. With IMAGE_PACK_REPEAT set, the one pixel after it is
+// repeated that many times, otherwise that many pixels follow
+#define IMAGE_PACK_REPEAT (1u << 31)
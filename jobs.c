@@ -0,0 +1,336 @@
+// threads, and a small work stealing job system on top of them for splitting the
+// simulation's per entity and per projectile loops across cores. Included by sim.c.
+// The web build doesn't have threads unless it's built with emscripten's -pthread,
+// without them everything runs on the thread that asked for it
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define NO_THREADS
+#elif defined(_WIN32)
+#include <windows.h>
+typedef HANDLE Semaphore;
+typedef CRITICAL_SECTION Mutex;
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+typedef struct Semaphore
+{
+ pthread_mutex_t mutex;
+ pthread_cond_t cond;
+ int count;
+} Semaphore;
+typedef pthread_mutex_t Mutex;
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#define atomic_add_long(ptr, value) InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(value)) // returns what it was before
+#define atomic_load_long(ptr) InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0)
+#ifdef _WIN64
+#define atomic_add_size(ptr, value) (size_t)InterlockedExchangeAdd64((volatile LONG64 *)(ptr), (LONG64)(value))
+#else
+#define atomic_add_size(ptr, value) (size_t)InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(value))
+#endif
+#else
+#define THREAD_LOCAL __thread
+#define atomic_add_long(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+#define atomic_load_long(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define atomic_add_size(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+#endif
+
+#ifndef NO_THREADS
+typedef void (*ThreadProc)(void *arg);
+typedef struct ThreadStart { ThreadProc proc; void *arg; } ThreadStart;
+
+#if defined(_WIN32)
+void semaphore_init(Semaphore *s) { *s = CreateSemaphoreA(NULL, 0, MAXLONG, NULL); }
+void semaphore_signal(Semaphore *s) { ReleaseSemaphore(*s, 1, NULL); }
+void semaphore_wait(Semaphore *s) { WaitForSingleObject(*s, INFINITE); }
+void mutex_init(Mutex *m) { InitializeCriticalSection(m); }
+void mutex_lock(Mutex *m) { EnterCriticalSection(m); }
+void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+void yield_thread() { SwitchToThread(); }
+int num_cores()
+{
+ SYSTEM_INFO info;
+ GetSystemInfo(&info);
+ return (int)info.dwNumberOfProcessors;
+}
+DWORD WINAPI thread_trampoline(LPVOID param)
+{
+ ThreadStart start = *(ThreadStart *)param;
+ free(param);
+ start.proc(start.arg);
+ return 0;
+}
+bool start_thread(ThreadProc proc, void *arg)
+{
+ ThreadStart *start = malloc(sizeof(*start));
+ *start = (ThreadStart){ proc, arg };
+ HANDLE thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+ if(thread == NULL)
+ {
+  free(start);
+  return false;
+ }
+ CloseHandle(thread);
+ return true;
+}
+#else
+void semaphore_init(Semaphore *s)
+{
+ pthread_mutex_init(&s->mutex, NULL);
+ pthread_cond_init(&s->cond, NULL);
+ s->count = 0;
+}
+void semaphore_signal(Semaphore *s)
+{
+ pthread_mutex_lock(&s->mutex);
+ s->count += 1;
+ pthread_cond_signal(&s->cond);
+ pthread_mutex_unlock(&s->mutex);
+}
+void semaphore_wait(Semaphore *s)
+{
+ pthread_mutex_lock(&s->mutex);
+ while(s->count == 0) pthread_cond_wait(&s->cond, &s->mutex);
+ s->count -= 1;
+ pthread_mutex_unlock(&s->mutex);
+}
+void mutex_init(Mutex *m) { pthread_mutex_init(m, NULL); }
+void mutex_lock(Mutex *m) { pthread_mutex_lock(m); }
+void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+void yield_thread() { sched_yield(); }
+int num_cores() { return (int)sysconf(_SC_NPROCESSORS_ONLN); }
+void *thread_trampoline(void *param)
+{
+ ThreadStart start = *(ThreadStart *)param;
+ free(param);
+ start.proc(start.arg);
+ return NULL;
+}
+bool start_thread(ThreadProc proc, void *arg)
+{
+ ThreadStart *start = malloc(sizeof(*start));
+ *start = (ThreadStart){ proc, arg };
+ pthread_t thread;
+ if(pthread_create(&thread, NULL, thread_trampoline, start) != 0)
+ {
+  free(start);
+  return false;
+ }
+ pthread_detach(thread);
+ return true;
+}
+#endif
+#endif // NO_THREADS
+
+// does the part of some work from `from` up to but not including `to`
+typedef void (*JobProc)(void *data, int from, int to);
+
+// how many jobs are left of some work. Waiting on it runs other jobs in the meantime,
+// so work that depends on other work can wait for it without wasting the thread
+typedef struct JobCounter
+{
+ long remaining;
+} JobCounter;
+
+typedef struct Job
+{
+ JobProc proc;
+ void *data;
+ int from;
+ int to;
+ JobCounter *counter;
+} Job;
+
+#define MAX_WORKERS 32
+#define MAX_QUEUED_JOBS 1024 // per worker, must be a power of two
+
+// each worker pushes and pops its own jobs at the bottom, and takes from the top of the
+// others' when it runs out. One lock each, so it's only contended when stealing
+typedef struct JobQueue
+{
+ Job jobs[MAX_QUEUED_JOBS];
+ int top; // oldest, where they're stolen from
+ int bottom; // newest, where the owner pushes and pops
+#ifndef NO_THREADS
+ Mutex lock;
+#endif
+} JobQueue;
+
+// worker 0 is whatever thread outside the pool hands out work, the one ticking the
+// simulation. Only one thread can do that at a time, other threads hand out background
+// jobs instead
+JobQueue job_queues[MAX_WORKERS] = {0};
+int num_workers = 1; // until jobs_init
+THREAD_LOCAL int worker_index = 0;
+#ifndef NO_THREADS
+Semaphore work_available;
+#endif
+
+// work that nothing waits on in the middle of something else, like loading assets. Only
+// idle workers and run_background_job take it, never wait_for_counter, so a tick
+// waiting on its own jobs doesn't get stuck decoding an image. Oldest first, from any thread
+JobQueue background_jobs = {0};
+
+bool push_job(JobQueue *q, Job job)
+{
+#ifndef NO_THREADS
+ mutex_lock(&q->lock);
+#endif
+ bool pushed = q->bottom - q->top < MAX_QUEUED_JOBS;
+ if(pushed)
+ {
+  q->jobs[q->bottom & (MAX_QUEUED_JOBS - 1)] = job;
+  q->bottom += 1;
+ }
+#ifndef NO_THREADS
+ mutex_unlock(&q->lock);
+#endif
+ return pushed;
+}
+
+// the newest job from the bottom, or the oldest from the top
+bool take_job(JobQueue *q, bool newest, Job *out)
+{
+#ifndef NO_THREADS
+ mutex_lock(&q->lock);
+#endif
+ bool found = q->bottom > q->top;
+ if(found)
+ {
+  if(newest)
+  {
+   q->bottom -= 1;
+   *out = q->jobs[q->bottom & (MAX_QUEUED_JOBS - 1)];
+  }
+  else
+  {
+   *out = q->jobs[q->top & (MAX_QUEUED_JOBS - 1)];
+   q->top += 1;
+  }
+ }
+#ifndef NO_THREADS
+ mutex_unlock(&q->lock);
+#endif
+ return found;
+}
+
+// its own newest job, or else the oldest of somebody else's
+bool next_job(Job *out)
+{
+ for(int i = 0; i < num_workers; i++)
+ {
+  int victim = (worker_index + i) % num_workers;
+  if(take_job(&job_queues[victim], i == 0, out)) return true;
+ }
+ return false;
+}
+
+void run_job(Job *job)
+{
+ job->proc(job->data, job->from, job->to);
+ atomic_add_long(&job->counter->remaining, -1);
+}
+
+void wait_for_counter(JobCounter *counter)
+{
+ while(atomic_load_long(&counter->remaining) > 0)
+ {
+  Job job;
+  if(next_job(&job)) run_job(&job);
+#ifndef NO_THREADS
+  else yield_thread();
+#endif
+ }
+}
+
+// runs the oldest background job if there is one, for a thread that isn't waiting on
+// anything to keep loading moving when there are no workers to do it
+bool run_background_job(void)
+{
+ Job job;
+ if(!take_job(&background_jobs, false, &job)) return false;
+ run_job(&job);
+ return true;
+}
+
+#ifndef NO_THREADS
+void worker_thread(void *arg)
+{
+ worker_index = (int)(intptr_t)arg;
+ semaphore_wait(&work_available); // until jobs_init knows how many of them started
+ while(true)
+ {
+  Job job;
+  if(next_job(&job) || take_job(&background_jobs, false, &job)) run_job(&job);
+  else semaphore_wait(&work_available);
+ }
+}
+#endif
+
+// starts the worker threads, -1 for one less than the number of cores. Without this,
+// or without threads, jobs run on the thread that waits for them
+void jobs_init(int num_threads)
+{
+#ifndef NO_THREADS
+ if(num_threads < 0) num_threads = num_cores() - 1;
+ if(num_threads > MAX_WORKERS - 1) num_threads = MAX_WORKERS - 1;
+ semaphore_init(&work_available);
+ for(int i = 0; i < MAX_WORKERS; i++) mutex_init(&job_queues[i].lock);
+ mutex_init(&background_jobs.lock);
+ // gets by with however many of them start
+ int started = 0;
+ while(started < num_threads && start_thread(worker_thread, (void *)(intptr_t)(started + 1))) started += 1;
+ if(started < num_threads) fprintf(stderr, "Could only start %d of %d worker threads\n", started, num_threads);
+ num_workers = 1 + started;
+ for(int i = 0; i < started; i++) semaphore_signal(&work_available);
+#else
+ (void)num_threads;
+#endif
+}
+
+// splits 0 up to count into jobs of batch_size, and returns right away. The counter
+// reaches zero when they're all done
+void parallel_for_async(JobCounter *counter, int count, int batch_size, JobProc proc, void *data)
+{
+ assert(batch_size > 0);
+ int num_jobs = 0;
+ for(int from = 0; from < count; from += batch_size)
+ {
+  int to = from + batch_size < count ? from + batch_size : count;
+  Job job = { .proc = proc, .data = data, .from = from, .to = to, .counter = counter };
+  atomic_add_long(&counter->remaining, 1);
+  if(push_job(&job_queues[worker_index], job)) num_jobs += 1;
+  else run_job(&job); // queue's full, no point waiting for somebody else to do it
+ }
+#ifndef NO_THREADS
+ if(num_jobs > num_workers - 1) num_jobs = num_workers - 1;
+ for(int i = 0; i < num_jobs; i++) semaphore_signal(&work_available);
+#endif
+}
+
+// queues a background job and returns right away, the counter reaches zero when it's done
+void start_background_job(JobCounter *counter, JobProc proc, void *data)
+{
+ Job job = { .proc = proc, .data = data, .from = 0, .to = 1, .counter = counter };
+ atomic_add_long(&counter->remaining, 1);
+ if(!push_job(&background_jobs, job)) run_job(&job);
+#ifndef NO_THREADS
+ else if(num_workers > 1) semaphore_signal(&work_available);
+#endif
+}
+
+// the jobs can run in any order on any thread, so each should only write to its own
+// part of things. Small counts that are a single batch just run here
+void parallel_for(int count, int batch_size, JobProc proc, void *data)
+{
+ if(count <= batch_size || num_workers == 1)
+ {
+  if(count > 0) proc(data, 0, count);
+  return;
+ }
+ JobCounter counter = {0};
+ parallel_for_async(&counter, count, batch_size, proc, data);
+ wait_for_counter(&counter);
+}
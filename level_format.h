@@ -0,0 +1,39 @@
+// the binary level files codegen bakes into assets/baked and the game loads, so levels
+// can be any size without the executable growing. Included by both so they agree.
+// Little endian, offsets are from the start of the file
+#pragma once
+#include <stdint.h>
+
+#define LEVEL_FILE_MAGIC 0x4C56454C // "LEVL"
+#define LEVEL_FILE_VERSION 1 // bump when anything here changes, old files won't load
+#define MAX_LEVEL_ENTITIES 128 // entities placed in the level editor
+#define LEVEL_CHUNK_TILES 32 // along a side. Tiles are compressed a chunk at a time so any chunk can be loaded on its own
+
+typedef struct LevelFileHeader
+{
+ uint32_t magic;
+ uint32_t version;
+ uint32_t chunk_tiles; // LEVEL_CHUNK_TILES when it was baked
+ int32_t width; // in tiles
+ int32_t height;
+ uint32_t num_entities;
+ uint32_t entities_offset; // LevelFileEntity each
+ uint32_t solid_offset; // bit per tile, (width + 63)/64 uint64_t's a row. 8 byte aligned so it's used in place
+ uint32_t chunks_offset; // a uint32_t offset to each chunk's runs, row of chunks after row, then one past the last chunk
+ uint32_t size; // of the whole file
+} LevelFileHeader;
+
+typedef struct LevelFileEntity
+{
+ uint32_t kind; // EntityKind
+ float x; // world position
+ float y;
+} LevelFileEntity;
+
+// a chunk's tiles are runs of the same tile, row after row. The parts of chunks that go
+// past the edge of the level are tile 0, no tile
+typedef struct LevelFileRun
+{
+ uint16_t count;
+ uint16_t kind;
+} LevelFileRun;
@@ -11,34 +11,17 @@
 #include "sokol_gfx.h"
 #include "sokol_time.h"
 #include "sokol_glue.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 #include "HandmadeMath.h"
 
 #pragma warning(disable : 4996) // fopen is safe. I don't care about fopen_s
 
-#include <math.h>
+#include "sim.c"
+#include "image_pack_format.h"
+#include "placeholder_image.gen.h"
 
-#define ARRLEN(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
-#define ENTITIES_ITER(ents) for(Entity *it = ents; it < ents + ARRLEN(ents); it++) if(it->exists)
-
-// so can be grep'd and removed
-#define dbgprint(...) { printf("Debug | %s:%d | ", __FILE__, __LINE__); printf(__VA_ARGS__); }
-Vec2 RotateV2(Vec2 v, float theta)
-{
-  return V2( 
-      v.X * cosf(theta) - v.Y * sinf(theta),
-      v.X * sinf(theta) + v.Y * cosf(theta)
-    );
-}
-
-typedef struct AABB
-{
- Vec2 upper_left;
- Vec2 lower_right;
-} AABB;
+#define MAX_DRAW_VERTICES (1024*256) // per frame, enough for the tilemap and a screen full of bullets
 
 typedef struct Quad
 {
@@ -55,51 +38,6 @@ typedef struct Quad
  };
 } Quad;
 
-typedef struct TileInstance
-{
- uint16_t kind;
-} TileInstance;
-
-typedef struct AnimatedTile
-{
- uint16_t id_from;
- int num_frames;
- uint16_t frames[32];
-} AnimatedTile;
-
-typedef struct TileSet
-{
- sg_image *img;
- AnimatedTile animated[128];
-} TileSet;
-
-typedef struct AnimatedSprite
-{
- sg_image *img;
- double time_per_frame;
- int num_frames;
- Vec2 start;
- float horizontal_diff_btwn_frames;
- Vec2 region_size;
- bool no_wrap; // does not wrap when playing
-} AnimatedSprite;
-
-typedef enum CharacterState
-{
- CHARACTER_WALKING,
- CHARACTER_IDLE,
- CHARACTER_ATTACK,
-} CharacterState;
-
-typedef enum EntityKind
-{
- ENTITY_INVALID, // zero initialized is invalid entity
-
- ENTITY_PLAYER,
- ENTITY_OLD_MAN,
- ENTITY_BULLET,
-} EntityKind;
-
 #define MAX_SENTENCE_LENGTH 400
 typedef struct { char text[MAX_SENTENCE_LENGTH]; } Sentence;
 
@@ -108,296 +46,274 @@ typedef struct Dialog
  Sentence sentences[8];
 } Dialog;
 
-typedef struct Entity
+sg_image make_image(int width, int height, const void *pixels)
 {
- bool exists;
- EntityKind kind;
+ return sg_make_image(&(sg_image_desc)
+   {
+   .width = width,
+   .height = height,
+   .pixel_format = SG_PIXELFORMAT_RGBA8,
+   .min_filter = SG_FILTER_NEAREST,
+   .num_mipmaps = 0,
+   .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+   .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+   .mag_filter = SG_FILTER_NEAREST,
+   .data.subimage[0][0] =
+   {
+   .ptr = pixels,
+   .size = (size_t)(width * height * 4),
+   }
+   });
+}
 
- // fields for all entities
- Vec2 pos;
- Vec2 vel; // only used sometimes, like in old man and bullet
- float damage; // at 1.0, he's dead
- bool facing_left;
-
- // old man
- bool aggressive;
- double shotgun_timer;
-
- // character
- CharacterState state;
- bool is_rolling; // can only roll in idle or walk states
- float speed; // for lerping to the speed, so that roll gives speed boost which fades
- double time_not_rolling; // for cooldown for roll, so you can't just hold it and be invincible
- double roll_progress;
- double swing_progress;
-} Entity;
-
-typedef struct Overlap
-{
- bool is_tile; // in which case e will be null, naturally
- TileInstance t;
- Entity *e;
-} Overlap;
-
-#define BUFF(type, max_size) struct { type data[max_size]; int cur_index; }
-#define BUFF_APPEND(buff_ptr, element)  { (buff_ptr)->data[(buff_ptr)->cur_index++] = element; assert((buff_ptr)->cur_index < ARRLEN((buff_ptr)->data)); }
-#define BUFF_ITER(type, buff_ptr) for(type *it = &((buff_ptr)->data[0]); it < (buff_ptr)->data + (buff_ptr)->cur_index; it++)
-
-typedef BUFF(Overlap, 16) Overlapping;
-
-#define LEVEL_TILES 60
-#define TILE_SIZE 32 // in pixels
-#define MAX_ENTITIES 128
-#define PLAYER_SPEED 3.5f // in meters per second
-#define PLAYER_ROLL_SPEED 7.0f
-typedef struct Level
+// fills pixels with the image's runs, see image_pack_format.h. image_pack_ok has to have
+// checked they fit
+void decode_pack_image(const uint8_t *runs, size_t size, uint32_t *pixels)
 {
- TileInstance tiles[LEVEL_TILES][LEVEL_TILES];
- Entity initial_entities[MAX_ENTITIES]; // shouldn't be directly modified, only used to initialize entities on loading of level
-} Level;
+ const uint8_t *end = runs + size;
+ uint32_t *out = pixels;
+ while(runs < end)
+ {
+  uint32_t header;
+  memcpy(&header, runs, sizeof(header));
+  runs += sizeof(header);
+  uint32_t count = header & ~IMAGE_PACK_REPEAT;
+  if(header & IMAGE_PACK_REPEAT)
+  {
+   uint32_t pixel;
+   memcpy(&pixel, runs, sizeof(pixel));
+   runs += sizeof(pixel);
+   for(uint32_t i = 0; i < count; i++) out[i] = pixel;
+  }
+  else
+  {
+   memcpy(out, runs, count*sizeof(uint32_t));
+   runs += count*sizeof(uint32_t);
+  }
+  out += count;
+ }
+}
 
-typedef struct TileCoord
-{
- int x;
- int y;
-} TileCoord;
+#define MAX_PACK_IMAGE_SIZE 16384 // along a side, more than gpus take anyway. Keeps the pixel count from overflowing
 
-// no alignment etc because lazy
-typedef struct Arena
+// whether the header, entries and every image's runs are inside the pack and decode to
+// exactly their images' pixels, so a broken pack can't make the decoding read or write
+// out of bounds. Checked once when it's loaded, the decoding trusts it
+bool image_pack_ok(const uint8_t *pack, size_t size)
 {
- char *data;
- size_t data_size;
- size_t cur;
-} Arena;
+ const ImagePackHeader *header = (const ImagePackHeader *)pack;
+ if(size < sizeof(*header) || header->magic != IMAGE_PACK_MAGIC || header->version != IMAGE_PACK_VERSION || header->ids_hash != IMAGE_IDS_HASH || header->size != size) return false;
+ if(header->num_images != IMAGE_LAST - 1) return false;
+ if(sizeof(*header) + (uint64_t)header->num_images*sizeof(ImagePackEntry) > size) return false;
 
-Arena make_arena(size_t max_size)
-{
- return (Arena)
+ const ImagePackEntry *entries = (const ImagePackEntry *)(pack + sizeof(*header));
+ for(uint32_t i = 0; i < header->num_images; i++)
  {
-  .data = calloc(max_size, 1),
-  .data_size = max_size,
-  .cur = 0,
- };
+  ImagePackEntry entry = entries[i];
+  if(entry.width == 0 || entry.height == 0 || entry.width > MAX_PACK_IMAGE_SIZE || entry.height > MAX_PACK_IMAGE_SIZE) return false;
+  if((uint64_t)entry.offset + entry.size > size) return false;
+  uint64_t pixels_left = (uint64_t)entry.width*entry.height;
+  const uint8_t *runs = pack + entry.offset;
+  uint64_t bytes_left = entry.size;
+  while(bytes_left > 0)
+  {
+   uint32_t run_header;
+   if(bytes_left < sizeof(run_header)) return false;
+   memcpy(&run_header, runs, sizeof(run_header));
+   runs += sizeof(run_header);
+   bytes_left -= sizeof(run_header);
+   uint64_t count = run_header & ~IMAGE_PACK_REPEAT;
+   if(count > pixels_left) return false;
+   uint64_t run_size = (run_header & IMAGE_PACK_REPEAT) ? sizeof(uint32_t) : count*sizeof(uint32_t);
+   if(run_size > bytes_left) return false;
+   runs += run_size;
+   bytes_left -= run_size;
+   pixels_left -= count;
+  }
+  if(pixels_left != 0) return false;
+ }
+ return true;
 }
 
-void reset(Arena *a)
-{
- memset(a->data, 0, a->data_size);
- a->cur = 0;
-}
+sg_image images[IMAGE_LAST] = {0};
+sg_image placeholder_image = {0};
 
-char *get(Arena *a, size_t of_size)
+// images load in the background and are drawn as the placeholder until they're in.
+// Reading and decoding the pack happen in background jobs, only the upload is on the main thread
+typedef struct ImageLoad
 {
- assert(a->data != NULL);
- char *to_return = a->data + a->cur;
- a->cur += of_size;
- assert(a->cur < a->data_size);
- return to_return;
-}
+ ImagePackEntry entry;
+ const uint8_t *runs; // in image_pack
+ uint32_t *pixels; // decoded, until it's uploaded
+ JobCounter decoding;
+ bool uploaded;
+} ImageLoad;
 
-Arena scratch = {0};
+ImageLoad image_loads[IMAGE_LAST] = {0};
+JobCounter image_pack_loading = {0}; // zero once it's read and its images are decoding
+uint8_t *image_pack = NULL; // freed when every image is uploaded
+int num_images_uploaded = 0;
 
-char *tprint(const char *format, ...)
+void decode_image_job(void *data, int from, int to)
 {
- va_list argptr;
- va_start(argptr, format);
-
- int size = vsnprintf(NULL, 0, format, argptr) + 1; // for null terminator
-
- char *to_return = get(&scratch, size);
-
- vsnprintf(to_return, size, format, argptr);
-
-  va_end(argptr);
-
-  return to_return;
+ (void)from; (void)to;
+ ImageLoad *load = data;
+ size_t num_pixels = (size_t)load->entry.width*load->entry.height;
+ load->pixels = malloc(num_pixels*sizeof(uint32_t));
+ decode_pack_image(load->runs, load->entry.size, load->pixels);
 }
 
-Vec2 entity_aabb_size(Entity *e)
+// checks the whole pack made it and starts a job decoding each image
+void start_decoding_images(uint8_t *pack, size_t size)
 {
- if(e->kind == ENTITY_PLAYER)
- {
-  return V2(TILE_SIZE, TILE_SIZE);
- }
- else if(e->kind == ENTITY_OLD_MAN)
- {
-  return V2(TILE_SIZE*0.5f, TILE_SIZE*0.5f);
- }
- else if(e->kind == ENTITY_BULLET)
+ if(!image_pack_ok(pack, size))
  {
-  return V2(TILE_SIZE*0.25f, TILE_SIZE*0.25f);
+  fprintf(stderr, "%s is from a different version of the game or broken, run codegen to make it again\n", IMAGE_PACK_PATH);
+  exit(1);
  }
- else
+ ImagePackHeader *header = (ImagePackHeader *)pack;
+
+ image_pack = pack;
+ ImagePackEntry *entries = (ImagePackEntry *)(pack + sizeof(*header));
+ for(uint32_t i = 0; i < header->num_images; i++)
  {
-  assert(false);
-  return (Vec2){0};
+  ImageLoad *load = &image_loads[IMAGE_INVALID + 1 + i];
+  load->entry = entries[i];
+  load->runs = pack + load->entry.offset;
+  start_background_job(&load->decoding, decode_image_job, load);
  }
 }
 
-bool is_tile_solid(TileInstance t)
-{
- uint16_t tile_id = t.kind;
- return tile_id == 53 || tile_id == 0 || tile_id == 367 || tile_id == 317 || tile_id == 313 || tile_id == 366 || tile_id == 368;
-}
-// tilecoord is integer tile position, not like tile coord
-Vec2 tilecoord_to_world(TileCoord t)
-{
- return V2( (float)t.x * (float)TILE_SIZE * 1.0f, -(float)t.y * (float)TILE_SIZE * 1.0f );
-}
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+// the web build downloads it separately instead of preloading it, so the page starts
+// without waiting on it. Next to the html, where the build scripts copy it
+#define IMAGE_PACK_URL "images.pack"
 
-// points from tiled editor have their own strange and alien coordinate system (local to the tilemap Y+ down)
-Vec2 tilepoint_to_world(Vec2 tilepoint)
+void image_pack_downloaded(void *arg, void *data, int size)
 {
- Vec2 tilecoord = MulV2F(tilepoint, 1.0/TILE_SIZE);
- return tilecoord_to_world((TileCoord){(int)tilecoord.X, (int)tilecoord.Y});
+ (void)arg;
+ uint8_t *pack = malloc((size_t)size); // emscripten frees data after this returns
+ memcpy(pack, data, (size_t)size);
+ start_decoding_images(pack, (size_t)size);
+ atomic_add_long(&image_pack_loading.remaining, -1);
 }
 
-TileCoord world_to_tilecoord(Vec2 w)
+void image_pack_download_failed(void *arg)
 {
- // world = V2(tilecoord.x * tile_size, -tilecoord.y * tile_size)
- // world.x = tilecoord.x * tile_size
- // world.x / tile_size = tilecoord.x
- // world.y = -tilecoord.y * tile_size
- // - world.y / tile_size = tilecoord.y
- return (TileCoord){ (int)floorf(w.X / TILE_SIZE), (int)floorf(-w.Y / TILE_SIZE) };
+ (void)arg;
+ fprintf(stderr, "Couldn't download %s\n", IMAGE_PACK_URL);
 }
-
-
-AABB tile_aabb(TileCoord t)
+#else
+void read_image_pack_job(void *data, int from, int to)
 {
- return (AABB)
+ (void)from; (void)to;
+ const char *path = data;
+ FILE *file = fopen(path, "rb");
+ if(file == NULL)
  {
-  .upper_left = tilecoord_to_world(t),
-   .lower_right = AddV2(tilecoord_to_world(t), V2(TILE_SIZE, -TILE_SIZE)),
- };
+  fprintf(stderr, "Couldn't open %s, run codegen to make it\n", path);
+  exit(1);
+ }
+ fseek(file, 0, SEEK_END);
+ size_t size = (size_t)ftell(file);
+ fseek(file, 0, SEEK_SET);
+ uint8_t *pack = malloc(size);
+ size_t read = fread(pack, 1, size, file);
+ fclose(file);
+ start_decoding_images(pack, read);
 }
+#endif
 
-Vec2 rotate_counter_clockwise(Vec2 v)
+// every image starts out as the placeholder, which is built into the executable
+void start_loading_images(void)
 {
- return V2(-v.Y, v.X);
+ placeholder_image = make_image(PLACEHOLDER_IMAGE_WIDTH, PLACEHOLDER_IMAGE_HEIGHT, placeholder_image_pixels);
+ for(int i = 0; i < IMAGE_LAST; i++) images[i] = placeholder_image;
+#ifdef __EMSCRIPTEN__
+ image_pack_loading.remaining = 1;
+ emscripten_async_wget_data(IMAGE_PACK_URL, NULL, image_pack_downloaded, image_pack_download_failed);
+#else
+ start_background_job(&image_pack_loading, read_image_pack_job, IMAGE_PACK_PATH);
+#endif
 }
 
-Vec2 aabb_center(AABB aabb)
+// swaps in whatever images have finished decoding. Only between frames, while nothing
+// else is looking at images
+void upload_loaded_images(void)
 {
- return MulV2F(AddV2(aabb.upper_left, aabb.lower_right), 0.5f);
+ if(atomic_load_long(&image_pack_loading.remaining) > 0 || image_pack == NULL) return;
+ for(int i = IMAGE_INVALID + 1; i < IMAGE_LAST; i++)
+ {
+  ImageLoad *load = &image_loads[i];
+  if(load->uploaded || atomic_load_long(&load->decoding.remaining) > 0) continue;
+  images[i] = make_image(load->entry.width, load->entry.height, load->pixels);
+  free(load->pixels);
+  load->pixels = NULL;
+  load->uploaded = true;
+  num_images_uploaded += 1;
+ }
+ if(num_images_uploaded == IMAGE_LAST - 1)
+ {
+  free(image_pack);
+  image_pack = NULL;
+ }
 }
 
-AABB centered_aabb(Vec2 at, Vec2 size)
-{
- return (AABB){
-  .upper_left  = AddV2(at, V2(-size.X/2.0f, size.Y/2.0f)),
-   .lower_right = AddV2(at, V2( size.X/2.0f, -size.Y/2.0f)),
- };
-}
+#include "quad-sapp.glsl.h"
 
-AABB entity_aabb(Entity *e)
-{
- return centered_aabb(e->pos, entity_aabb_size(e));
-}
+sg_image image_font = {0};
+const float font_size = 32.0;
+stbtt_bakedchar cdata[96]; // ASCII 32..126 is 95 glyphs, all zero size until the font's uploaded
 
-TileInstance get_tile(Level *l, TileCoord t)
+// the font's baked in a job like the images, text just doesn't show until it's done
+struct
 {
- bool out_of_bounds = false;
- out_of_bounds |= t.x < 0;
- out_of_bounds |= t.x >= LEVEL_TILES;
- out_of_bounds |= t.y < 0;
- out_of_bounds |= t.y >= LEVEL_TILES;
- //assert(!out_of_bounds);
- if(out_of_bounds) return (TileInstance){0};
- return l->tiles[t.y][t.x];
-}
+ stbtt_bakedchar cdata[96];
+ unsigned char *rgba;
+ JobCounter baking;
+ bool uploaded;
+} font_load = {0};
 
-sg_image load_image(const char *path)
+void bake_font_job(void *data, int from, int to)
 {
- sg_image to_return = {0};
-
- int png_width, png_height, num_channels;
- const int desired_channels = 4;
- stbi_uc* pixels = stbi_load(
-   path,
-   &png_width, &png_height,
-   &num_channels, 0);
- assert(pixels);
- dbgprint("Pah %s | Loading image with dimensions %d %d\n", path, png_width, png_height);
- to_return = sg_make_image(&(sg_image_desc)
-   {
-   .width = png_width,
-   .height = png_height,
-   .pixel_format = SG_PIXELFORMAT_RGBA8,
-   .min_filter = SG_FILTER_NEAREST,
-   .num_mipmaps = 0,
-   .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
-   .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
-   .mag_filter = SG_FILTER_NEAREST,
-   .data.subimage[0][0] =
-   {
-   .ptr = pixels,
-   .size = (size_t)(png_width * png_height * 4),
-   }
-   });
- stbi_image_free(pixels);
- return to_return;
-}
+ (void)data; (void)from; (void)to;
+ FILE* fontFile = fopen("assets/orange kid.ttf", "rb");
+ fseek(fontFile, 0, SEEK_END);
+ size_t size = ftell(fontFile); /* how long is the file ? */
+ fseek(fontFile, 0, SEEK_SET); /* reset */
 
-#include "quad-sapp.glsl.h"
-#include "assets.gen.c"
+ unsigned char *fontBuffer = malloc(size);
 
-AnimatedSprite knight_idle =
-{
- .img = &image_knight_idle,
- .time_per_frame = 0.3,
- .num_frames = 10,
- .start = {16.0f, 0.0f},
- .horizontal_diff_btwn_frames = 120.0,
- .region_size = {80.0f, 80.0f},
-};
-
-AnimatedSprite knight_running =
-{
- .img = &image_knight_run,
- .time_per_frame = 0.06,
- .num_frames = 10,
- .start = {19.0f, 0.0f},
- .horizontal_diff_btwn_frames = 120.0,
- .region_size = {80.0f, 80.0f},
-};
-
-AnimatedSprite knight_rolling =
-{
- .img = &image_knight_roll,
- .time_per_frame = 0.05,
- .num_frames = 12,
- .start = {19.0f, 0.0f},
- .horizontal_diff_btwn_frames = 120.0,
- .region_size = {80.0f, 80.0f},
- .no_wrap = true,
-};
+ fread(fontBuffer, size, 1, fontFile);
+ fclose(fontFile);
 
+ unsigned char *font_bitmap = calloc(1, 512*512);
+ stbtt_BakeFontBitmap(fontBuffer, 0, font_size, font_bitmap, 512, 512, 32, 96, font_load.cdata);
+ free(fontBuffer);
 
-AnimatedSprite knight_attack = 
-{
- .img = &image_knight_attack,
- .time_per_frame = 0.06,
- .num_frames = 4,
- .start = {37.0f, 0.0f},
- .horizontal_diff_btwn_frames = 120.0,
- .region_size = {80.0f, 80.0f},
- .no_wrap = true,
-};
-
-AnimatedSprite old_man_idle = 
-{
- .img = &image_old_man,
- .time_per_frame = 0.4,
- .num_frames = 4,
- .start = {0.0, 0.0},
- .horizontal_diff_btwn_frames = 16.0f,
- .region_size = {16.0f, 16.0f},
-};
+ unsigned char *font_bitmap_rgba = malloc(4 * 512 * 512); // stack would be too big if allocated on stack (stack overflow)
+ for(int i = 0; i < 512 * 512; i++)
+ {
+  font_bitmap_rgba[i*4 + 0] = 255;
+  font_bitmap_rgba[i*4 + 1] = 255;
+  font_bitmap_rgba[i*4 + 2] = 255;
+  font_bitmap_rgba[i*4 + 3] = font_bitmap[i];
+ }
+ free(font_bitmap);
+ font_load.rgba = font_bitmap_rgba;
+}
 
-sg_image image_font = {0};
-const float font_size = 32.0;
-stbtt_bakedchar cdata[96]; // ASCII 32..126 is 95 glyphs
+// same rules as upload_loaded_images
+void upload_loaded_font(void)
+{
+ if(font_load.uploaded || atomic_load_long(&font_load.baking.remaining) > 0) return;
+ image_font = make_image(512, 512, font_load.rgba);
+ memcpy(cdata, font_load.cdata, sizeof(cdata));
+ free(font_load.rgba);
+ font_load.rgba = NULL;
+ font_load.uploaded = true;
+}
 
 
 static struct
@@ -407,48 +323,6 @@ static struct
  sg_bindings bind;
 } state;
 
-AABB level_aabb = { .upper_left = {0.0f, 0.0f}, .lower_right = {2000.0f, -2000.0f} };
-Entity entities[MAX_ENTITIES] = {0};
-Entity *player = NULL;
-
-Entity *new_entity()
-{
- for(int i = 0; i < ARRLEN(entities); i++)
- {
-  if(!entities[i].exists)
-  {
-   Entity *to_return = &entities[i];
-   *to_return = (Entity){0};
-   to_return->exists = true;
-   return to_return;
-  }
- }
- assert(false);
- return NULL;
-}
-
-void reset_level()
-{
- // load level
- Level *to_load = &level_level0;
- {
-  assert(ARRLEN(to_load->initial_entities) == ARRLEN(entities));
-  memcpy(entities, to_load->initial_entities, sizeof(Entity) * MAX_ENTITIES);
-
-  player = NULL;
-  ENTITIES_ITER(entities)
-  {
-   if(it->kind == ENTITY_PLAYER)
-   {
-    assert(player == NULL);
-    player = it;
-   }
-  }
-  assert(player != NULL); // level initial config must have player entity
- }
-}
-
-
 void init(void)
 {
  sg_setup(&(sg_desc){
@@ -456,55 +330,24 @@ void init(void)
   });
  stm_setup();
 
- scratch = make_arena(1024 * 10);
+ scratch = make_arena(1024 * 1024 * 8); // query results live here for the frame too, so they have no max size
+ jobs_init(-1);
 
- load_assets();
- reset_level();
-
- // load font
+ start_loading_images();
+ image_font = placeholder_image;
+ start_background_job(&font_load.baking, bake_font_job, NULL);
+ for(int i = 0; i < ENTITY_LAST; i++)
  {
-  FILE* fontFile = fopen("assets/orange kid.ttf", "rb");
-  fseek(fontFile, 0, SEEK_END);
-  size_t size = ftell(fontFile); /* how long is the file ? */
-  fseek(fontFile, 0, SEEK_SET); /* reset */
-
-  unsigned char *fontBuffer = malloc(size);
-
-  fread(fontBuffer, size, 1, fontFile);
-  fclose(fontFile);
-
-  unsigned char *font_bitmap = calloc(1, 512*512);
-  stbtt_BakeFontBitmap(fontBuffer, 0, font_size, font_bitmap, 512, 512, 32, 96, cdata);
-
-  unsigned char *font_bitmap_rgba = malloc(4 * 512 * 512); // stack would be too big if allocated on stack (stack overflow)
-  for(int i = 0; i < 512 * 512; i++)
-  {
-   font_bitmap_rgba[i*4 + 0] = 255;
-   font_bitmap_rgba[i*4 + 1] = 255;
-   font_bitmap_rgba[i*4 + 2] = 255;
-   font_bitmap_rgba[i*4 + 3] = font_bitmap[i];
-  }
-
-  image_font = sg_make_image( &(sg_image_desc){
-    .width = 512,
-    .height = 512,
-    .pixel_format = SG_PIXELFORMAT_RGBA8,
-    .min_filter = SG_FILTER_NEAREST,
-    .mag_filter = SG_FILTER_NEAREST,
-    .data.subimage[0][0] =
-    {
-    .ptr = font_bitmap_rgba,
-    .size = (size_t)(512 * 512 * 4),
-    }
-  } );
-  free(font_bitmap_rgba);
+  // the broadphase doesn't look any further than this for entities around a query
+  assert(archetypes[i].size.X <= LARGEST_ENTITY_SIZE && archetypes[i].size.Y <= LARGEST_ENTITY_SIZE);
  }
+ reset_level();
 
  state.bind.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc)
    {
     .usage = SG_USAGE_STREAM,
     //.data = SG_RANGE(vertices),
-    .size = 1024*500,
+    .size = MAX_DRAW_VERTICES*4*sizeof(float),
     .label = "quad-vertices"
    });
 
@@ -553,9 +396,28 @@ typedef Vec4 Color;
 #define GREEN (Color){0.0f, 1.0f, 0.0f, 1.0f}
 
 
+// everything building a frame needs from the main thread. Copied while the sim thread
+// is waiting, so events coming in while it builds the frame don't change it halfway
+typedef struct FrameInput
+{
+ double dt;
+ InputKeys keys;
+ Vec2 mouse_pos; // in screen space
+ Vec2 screen_size;
+ int num_draw_calls; // in the last frame submitted
+ double submit_time; // of the last frame submitted
+#ifdef DEVTOOLS
+ bool quicksave;
+ bool quickload;
+#endif
+} FrameInput;
+
+FrameInput frame_input = {0};
+
+// of the frame being built
 Vec2 screen_size()
 {
- return V2((float)sapp_width(), (float)sapp_height());
+ return frame_input.screen_size;
 }
 
 typedef struct Camera
@@ -564,10 +426,6 @@ typedef struct Camera
  float scale;
 } Camera;
 
-
-// everything is in pixels in world space, 43 pixels is approx 1 meter measured from 
-// merchant sprite being 5'6"
-const float pixels_per_meter = 43.0f;
 Camera cam = {.scale = 2.0f };
 
 Vec2 cam_offset()
@@ -662,84 +520,57 @@ Quad quad_aabb(AABB aabb)
 }
 
 
-// both segment_a and segment_b must be arrays of length 2
-bool segments_overlapping(float *a_segment, float *b_segment)
+// consecutive quads with the same image, drawn with one draw call
+typedef struct DrawBatch
 {
- assert(a_segment[1] >= a_segment[0]);
- assert(b_segment[1] >= b_segment[0]);
- float total_length = (a_segment[1] - a_segment[0]) + (b_segment[1] - b_segment[0]);
- float farthest_to_left = fminf(a_segment[0], b_segment[0]);
- float farthest_to_right = fmaxf(a_segment[1], b_segment[1]);
- if (farthest_to_right - farthest_to_left < total_length)
- {
-  return true;
- } else
- {
-  return false;
- }
-}
+ sg_image image;
+ quad_fs_params_t params; // @TODO check tint as well, this is the first quad's
+ int first_vertex;
+ int num_vertices;
+} DrawBatch;
 
-bool overlapping(AABB a, AABB b)
+// all the drawing of a frame, built without touching the gpu so it can be done off the
+// main thread. Vertices are position then texcoord, in clip and uv space
+typedef struct DrawList
 {
- // x axis
+ float vertices[MAX_DRAW_VERTICES*4];
+ int num_vertices;
+ BUFF(DrawBatch, 1024*4) batches;
+} DrawList;
 
- {
-  float a_segment[2] =
-  { a.upper_left.X, a.lower_right.X };
-  float b_segment[2] =
-  { b.upper_left.X, b.lower_right.X };
-  if(segments_overlapping(a_segment, b_segment))
-  {
-  } else
-  {
-   return false;
-  }
- }
-
- // y axis
+DrawList draw_lists[2] = {0}; // one being built while the other is submitted
+DrawList *recording = &draw_lists[0]; // what the draw functions add to
 
+// room for a quad's 6 vertices, batched with the last quad if it has the same image
+float *push_quad_vertices(sg_image image, quad_fs_params_t params)
+{
+ DrawList *l = recording;
+ DrawBatch *last = l->batches.cur_index > 0 ? &l->batches.data[l->batches.cur_index - 1] : NULL;
+ if(last == NULL || last->image.id != image.id)
  {
-  float a_segment[2] =
-  { a.lower_right.Y, a.upper_left.Y };
-  float b_segment[2] =
-  { b.lower_right.Y, b.upper_left.Y };
-  if(segments_overlapping(a_segment, b_segment))
-  {
-  } else
-  {
-   return false;
-  }
+  BUFF_APPEND(&l->batches, ((DrawBatch){ .image = image, .params = params, .first_vertex = l->num_vertices }));
+  last = &l->batches.data[l->batches.cur_index - 1];
  }
-
- return true; // both segments overlapping
-}
-
-bool has_point(AABB aabb, Vec2 point)
-{
- return
-  (aabb.upper_left.X < point.X && point.X < aabb.lower_right.X) &&
-  (aabb.upper_left.Y > point.Y && point.Y > aabb.lower_right.Y);
+ assert(l->num_vertices + 6 <= MAX_DRAW_VERTICES);
+ float *to_return = &l->vertices[l->num_vertices*4];
+ l->num_vertices += 6;
+ last->num_vertices += 6;
+ return to_return;
 }
 
-int num_draw_calls = 0;
-
-float cur_batch_data[1024*10] = {0};
-int cur_batch_data_index = 0;
-// @TODO check last tint as well, do this when factor into drawing parameters
-sg_image cur_batch_image = {0};
-quad_fs_params_t cur_batch_params = {0};
-void flush_quad_batch()
+// main thread only
+int submit_draw_list(DrawList *l)
 {
- if(cur_batch_image.id == 0 || cur_batch_data_index == 0) return; // flush called when image changes, image starts out null!
- state.bind.vertex_buffer_offsets[0] = sg_append_buffer(state.bind.vertex_buffers[0], &(sg_range){cur_batch_data, cur_batch_data_index*sizeof(*cur_batch_data)});
- state.bind.fs_images[SLOT_quad_tex] = cur_batch_image;
- sg_apply_bindings(&state.bind);
- sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_quad_fs_params, &SG_RANGE(cur_batch_params));
- assert(cur_batch_data_index % 4 == 0);
- sg_draw(0, cur_batch_data_index/4, 1);
- num_draw_calls += 1;
- memset(cur_batch_data, 0, cur_batch_data_index);
- cur_batch_data_index = 0;
+ if(l->num_vertices == 0) return 0;
+ state.bind.vertex_buffer_offsets[0] = sg_append_buffer(state.bind.vertex_buffers[0], &(sg_range){l->vertices, l->num_vertices*4*sizeof(float)});
+ BUFF_ITER(DrawBatch, &l->batches)
+ {
+  state.bind.fs_images[SLOT_quad_tex] = it->image;
+  sg_apply_bindings(&state.bind);
+  sg_apply_uniforms(SG_SHADERSTAGE_FS, SLOT_quad_fs_params, &SG_RANGE(it->params));
+  sg_draw(it->first_vertex, it->num_vertices, 1);
+ }
+ return l->batches.cur_index;
 }
 
 // The image region is in pixel space of the image
@@ -751,13 +582,6 @@ void draw_quad(bool world_space, Quad quad, sg_image image, AABB image_region, C
  params.tint[2] = tint.B;
  params.tint[3] = tint.A;
 
- if(image.id != cur_batch_image.id)
- {
-  flush_quad_batch();
-  cur_batch_image = image;
-  cur_batch_params = params;
- }
-
  Vec2 *points = quad.points;
 
  if(world_space)
@@ -799,7 +623,9 @@ void draw_quad(bool world_space, Quad quad, sg_image image, AABB image_region, C
   AddV2(image_region.upper_left, V2(0.0,           region_size.Y)),
  };
 
- // convert to uv space
+ // convert to uv space. Images are made on the main thread as they finish loading, but
+ // only between waiting on frame_built and signaling frame_requested, while the sim
+ // thread is idle. So this reading them from the sim thread never overlaps with that
  sg_image_info info = sg_query_image_info(image);
  for(int i = 0; i < 4; i++)
  {
@@ -815,17 +641,8 @@ void draw_quad(bool world_space, Quad quad, sg_image image, AABB image_region, C
   new_vertices[i*4 + 3] = tex_coords[i].Y;
  }
 
- size_t total_size = ARRLEN(new_vertices)*sizeof(new_vertices);
-
- // batched a little too close to the sun
- if(cur_batch_data_index + total_size >= ARRLEN(cur_batch_data))
- {
-  flush_quad_batch();
-  cur_batch_image = image;
-  cur_batch_params = params;
- }
-
-#define PUSH_VERTEX(vert) { memcpy(&cur_batch_data[cur_batch_data_index], &vert, 4*sizeof(float)); cur_batch_data_index += 4; }
+ float *to = push_quad_vertices(image, params);
+#define PUSH_VERTEX(vert) { memcpy(to, &vert, 4*sizeof(float)); to += 4; }
  PUSH_VERTEX(new_vertices[0*4]);
  PUSH_VERTEX(new_vertices[1*4]);
  PUSH_VERTEX(new_vertices[2*4]);
@@ -843,14 +660,9 @@ void swap(Vec2 *p1, Vec2 *p2)
  *p2 = tmp;
 }
 
-double anim_sprite_duration(AnimatedSprite *s)
-{
- return s->num_frames * s->time_per_frame;
-}
-
 void draw_animated_sprite(AnimatedSprite *s, double elapsed_time, bool flipped, Vec2 pos, Color tint)
 {
- sg_image spritesheet_img = *s->img;
+ sg_image spritesheet_img = images[s->img];
  int index = (int)floor(elapsed_time/s->time_per_frame) % s->num_frames;
  if(s->no_wrap)
  {
@@ -887,7 +699,7 @@ Vec2 tile_id_to_coord(sg_image tileset_image, Vec2 tile_size, uint16_t tile_id)
 
 void colorquad(bool world_space, Quad q, Color col)
 {
- draw_quad(world_space, q, image_white_square, full_region(image_white_square), col);
+ draw_quad(world_space, q, images[IMAGE_WHITE_SQUARE], full_region(images[IMAGE_WHITE_SQUARE]), col);
 }
 
 void dbgsquare(Vec2 at)
@@ -1013,119 +825,38 @@ AABB draw_text(bool world_space, bool dry_run, const char *text, Vec2 pos, Color
  return bounds;
 }
 
-// gets aabbs overlapping the input aabb, including entities and tiles
-Overlapping get_overlapping(Level *l, AABB aabb)
+// writes the vertices straight into the draw list, everything draw_quad works out
+// per quad is the same for all of them. Alpha is how far between the last two ticks
+// to draw them
+void draw_projectiles(float alpha)
 {
- Overlapping to_return = {0};
- 
- Quad q = quad_aabb(aabb);
- // the corners, jessie
- for(int i = 0; i < 4; i++)
+ quad_fs_params_t params = { .tint = {1.0f, 1.0f, 1.0f, 1.0f} };
+ Vec2 screen = screen_size();
+ float half_size = PROJECTILE_SIZE*0.5f*cam.scale;
+ for(int i = 0; i < projectiles.count; i++)
  {
-  TileInstance t = get_tile(l, world_to_tilecoord(q.points[i]));
-  if(is_tile_solid(t))
+  Vec2 center = world_to_screen(V2(Lerp(projectiles.prev_x[i], alpha, projectiles.pos_x[i]), Lerp(projectiles.prev_y[i], alpha, projectiles.pos_y[i])));
+  if(center.X + half_size < 0.0f || center.X - half_size > screen.X || center.Y + half_size < 0.0f || center.Y - half_size > screen.Y) continue; // cull out of screen
+
+  // in clip space
+  float left = (center.X - half_size)/screen.X*2.0f - 1.0f;
+  float right = (center.X + half_size)/screen.X*2.0f - 1.0f;
+  float top = (center.Y + half_size)/screen.Y*2.0f - 1.0f;
+  float bottom = (center.Y - half_size)/screen.Y*2.0f - 1.0f;
+  float corners[4][4] =
   {
-   Overlap element = ((Overlap){.is_tile = true, .t = t});
-   //{ (&to_return)[(&to_return)->cur_index++] = element; assert((&to_return)->cur_index < ARRLEN((&to_return)->data)); }
-   BUFF_APPEND(&to_return, element);
-  }
- }
-
- // the entities jessie
- ENTITIES_ITER(entities)
- {
-  if(!(it->kind == ENTITY_PLAYER && it->is_rolling) && overlapping(aabb, entity_aabb(it)))
-  {
-   BUFF_APPEND(&to_return, (Overlap){.e = it});
-  }
- }
-
- return to_return;
-}
-
-// returns new pos after moving and sliding against collidable things
-Vec2 move_and_slide(Entity *from, Vec2 position, Vec2 movement_this_frame)
-{
- Vec2 collision_aabb_size = entity_aabb_size(from);
- Vec2 new_pos = AddV2(position, movement_this_frame);
- AABB at_new = centered_aabb(new_pos, collision_aabb_size);
- dbgrect(at_new);
- AABB to_check[256] = {0};
- int to_check_index = 0;
-
- // add tilemap boxes
- {
-  Vec2 at_new_size_vector = SubV2(at_new.lower_right, at_new.upper_left);
-  Vec2 points_to_check[] = {
-   AddV2(at_new.upper_left, V2(0.0, 0.0)),
-   AddV2(at_new.upper_left, V2(at_new_size_vector.X, 0.0)),
-   AddV2(at_new.upper_left, V2(at_new_size_vector.X, at_new_size_vector.Y)),
-   AddV2(at_new.upper_left, V2(0.0, at_new_size_vector.Y)),
+   { left, top, 0.0f, 0.0f },
+   { right, top, 1.0f, 0.0f },
+   { right, bottom, 1.0f, 1.0f },
+   { left, bottom, 0.0f, 1.0f },
   };
-  for(int i = 0; i < ARRLEN(points_to_check); i++)
+  const int order[6] = { 0, 1, 2, 0, 2, 3 };
+  float *to = push_quad_vertices(images[IMAGE_WHITE_SQUARE], params);
+  for(int v = 0; v < 6; v++)
   {
-   Vec2 *it = &points_to_check[i];
-   TileCoord tilecoord_to_check = world_to_tilecoord(*it);
-
-   if(is_tile_solid(get_tile(&level_level0, tilecoord_to_check)))
-   {
-    to_check[to_check_index++] = tile_aabb(tilecoord_to_check);
-    assert(to_check_index < ARRLEN(to_check));
-   }
-  }
- }
-
- // add entity boxes
- if(!(from->kind == ENTITY_PLAYER && from->is_rolling))
- {
-  ENTITIES_ITER(entities)
-  {
-   if(!(it->kind == ENTITY_PLAYER && it->is_rolling) && it != from)
-   {
-    to_check[to_check_index++] = centered_aabb(it->pos, entity_aabb_size(it));
-    assert(to_check_index < ARRLEN(to_check));
-   }
+   memcpy(to + v*4, corners[order[v]], 4*sizeof(float));
   }
  }
- for(int i = 0; i < to_check_index; i++)
- {
-  AABB to_depenetrate_from = to_check[i];
-  dbgrect(to_depenetrate_from);
-  int iters_tried_to_push_apart = 0;
-  while(overlapping(to_depenetrate_from, at_new) && iters_tried_to_push_apart < 500)
-  { 
-   //dbgsquare(to_depenetrate_from.upper_left);
-   //dbgsquare(to_depenetrate_from.lower_right);
-   const float move_dist = 0.05f;
-
-   Vec2 to_player = NormV2(SubV2(aabb_center(at_new), aabb_center(to_depenetrate_from)));
-   Vec2 compass_dirs[4] = {
-    V2( 1.0, 0.0),
-    V2(-1.0, 0.0),
-    V2(0.0,  1.0),
-    V2(0.0, -1.0),
-   };
-   int closest_index = -1;
-   float closest_dot = -99999999.0f;
-   for(int i = 0; i < 4; i++)
-   {
-    float dot = DotV2(compass_dirs[i], to_player);
-    if(dot > closest_dot)
-    {
-     closest_index = i;
-     closest_dot = dot;
-    }
-   }
-   assert(closest_index != -1);
-   Vec2 move_dir = compass_dirs[closest_index];
-   Vec2 move = MulV2F(move_dir, move_dist);
-   at_new.upper_left = AddV2(at_new.upper_left,move);
-   at_new.lower_right = AddV2(at_new.lower_right,move);
-   iters_tried_to_push_apart++;
-  }
- }
-
- return aabb_center(at_new);
 }
 
 // returns next vertical cursor position
@@ -1171,66 +902,97 @@ float draw_wrapped_text(Vec2 at_point, float max_width, char *text, float text_s
  return cursor.Y;
 }
 
+bool can_talk_to(Entity *e)
+{
+ return e->kind == ENTITY_OLD_MAN && !old_man(e)->aggressive;
+}
+
 double elapsed_time = 0.0;
-double last_frame_processing_time = 0.0;
+double last_frame_processing_time = 0.0; // sim thread, building the frame
+double last_frame_submit_time = 0.0; // main thread, drawing it
+int num_draw_calls = 0;
 uint64_t last_frame_time;
 Vec2 mouse_pos = {0}; // in screen space
 bool keydown[SAPP_KEYCODE_MENU] = {0};
 #ifdef DEVTOOLS
 bool mouse_frozen = false;
+bool quicksave_pressed = false;
+bool quickload_pressed = false;
+uint64_t *quicksave = NULL; // snapshot of the world, in memory so it's instant
 #endif
-void frame(void)
+void draw_old_men(float alpha)
 {
-#if 0
+ BUFF_ITER(OldMan, &old_men)
  {
-  sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
-  sg_apply_pipeline(state.pip);
+  const EntityArchetype *a = &archetypes[ENTITY_OLD_MAN];
+  draw_animated_sprite(a->idle, elapsed_time, false, AddV2(interpolated_pos(&entities[it->entity], alpha), a->sprite_offset), WHITE);
+ }
+}
+
+void draw_characters(float alpha)
+{
+ BUFF_ITER(Character, &characters)
+ {
+  Entity *e = &entities[it->entity];
+  const EntityArchetype *a = &archetypes[e->kind];
+  Vec2 sprite_pos = AddV2(interpolated_pos(e, alpha), a->sprite_offset);
+  if(it->is_rolling)
+  {
+   draw_animated_sprite(a->rolling, it->roll_progress, it->facing_left, sprite_pos, WHITE);
+  }
+  else if(it->state == CHARACTER_WALKING)
+  {
+   draw_animated_sprite(a->running, elapsed_time, it->facing_left, sprite_pos, WHITE);
+  }
+  else if(it->state == CHARACTER_IDLE)
+  {
+   draw_animated_sprite(a->idle, elapsed_time, it->facing_left, sprite_pos, WHITE);
+  }
+  else if(it->state == CHARACTER_ATTACK)
+  {
+   draw_animated_sprite(a->attack, it->swing_progress, it->facing_left, sprite_pos, WHITE);
+  }
+ }
+}
+
+double tick_accumulator = 0.0; // time the simulation is behind the frame, less than a tick after ticking
+
+// simulates and draws a frame into the recording draw list from frame_input. Doesn't
+// touch the gpu or sokol app, it runs on the sim thread
+void build_frame(void)
+{
+ uint64_t time_start_frame = stm_now();
+ recording->num_vertices = 0;
+ recording->batches.cur_index = 0;
 
+ double dt_double = frame_input.dt;
+ elapsed_time += dt_double;
+ float dt = (float)dt_double;
+
+#if 0
+ {
   //colorquad(false, quad_at(V2(0.0, 100.0), V2(100.0f, 100.0f)), RED);
   sg_image img = image_wonky_mystery_tile;
   AABB region = full_region(img);
   //region.lower_right.X *= 0.5f;
   draw_quad(false,quad_at(V2(0.0, 100.0), V2(100.0f, 100.0f)), img, region, WHITE);
 
-  sg_end_pass();
-  sg_commit();
   reset(&scratch);
  }
  return;
 #endif
 
- uint64_t time_start_frame = stm_now();
- // elapsed_time
- double dt_double = 0.0;
- {
-  dt_double = stm_sec(stm_diff(stm_now(), last_frame_time));
-  dt_double = fmin(dt_double, 5.0 / 60.0); // clamp dt at maximum 5 frames, avoid super huge dt
-  elapsed_time += dt_double;
-  last_frame_time = stm_now();
- }
- float dt = (float)dt_double;
-
- Vec2 movement = V2(
-  (float)keydown[SAPP_KEYCODE_D] - (float)keydown[SAPP_KEYCODE_A],
-  (float)keydown[SAPP_KEYCODE_W] - (float)keydown[SAPP_KEYCODE_S]
- );
- bool attack = keydown[SAPP_KEYCODE_J];
- bool roll = keydown[SAPP_KEYCODE_K];
- if(LenV2(movement) > 1.0)
- {
-  movement = NormV2(movement);
- }
- sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
- sg_apply_pipeline(state.pip);
-
  // tilemap
 #if 1
  Level * cur_level = &level_level0;
 
- for(int row = 0; row < LEVEL_TILES; row++)
+ // only what's on screen, out of the chunks loaded around it
+ AABB view = { .upper_left = screen_to_world(V2(0.0f, screen_size().Y)), .lower_right = screen_to_world(V2(screen_size().X, 0.0f)) };
+ stream_chunks(cur_level, view);
+ TileRange visible = aabb_tile_range(view);
+ for(int row = visible.from.y; row <= visible.to.y; row++)
  {
-  for(int col = 0; col < LEVEL_TILES; col++)
-
+  for(int col = visible.from.x; col <= visible.to.x; col++)
   {
    TileCoord cur_coord = { col, row };
    TileInstance cur = get_tile(cur_level, cur_coord);
@@ -1239,7 +1001,7 @@ void frame(void)
    {
     Vec2 tile_size = V2(TILE_SIZE, TILE_SIZE);
 
-    sg_image tileset_image = *tileset.img;
+    sg_image tileset_image = images[tileset.img];
 
     Vec2 tile_image_coord = tile_id_to_coord(tileset_image, tile_size, cur.kind);
 
@@ -1268,18 +1030,17 @@ void frame(void)
  }
 #endif
 
- assert(player != NULL);
-
 #ifdef DEVTOOLS
-  dbgsquare(screen_to_world(mouse_pos));
+  dbgsquare(screen_to_world(frame_input.mouse_pos));
   
   // tile coord
   {
-   TileCoord hovering = world_to_tilecoord(screen_to_world(mouse_pos));
+   TileCoord hovering = world_to_tilecoord(screen_to_world(frame_input.mouse_pos));
    Vec2 points[4] ={0};
    AABB q = tile_aabb(hovering);
    dbgrect(q);
-   draw_text(false, false, tprint("%d", get_tile(&level_level0, hovering).kind), world_to_screen(tilecoord_to_world(hovering)), BLACK, 1.0f);
+   TileInstance hovering_tile = get_tile(&level_level0, hovering);
+   draw_text(false, false, tprint("%d%s", hovering_tile.kind, is_tile_solid(&tileset_ruins_animated, hovering_tile) ? " solid" : ""), world_to_screen(tilecoord_to_world(hovering)), BLACK, 1.0f);
   }
 
   // debug draw font image
@@ -1290,223 +1051,77 @@ void frame(void)
   // statistics
   {
    Vec2 pos = V2(0.0, screen_size().Y);
-   int num_entities = 0;
-   ENTITIES_ITER(entities) num_entities++;
-   char *stats = tprint("Frametime: %.1f ms\nProcessing: %.1f ms\nEntities: %d\nDraw calls: %d\n", dt*1000.0, last_frame_processing_time*1000.0, num_entities, num_draw_calls);
+   char *stats = tprint("Frametime: %.1f ms\nProcessing: %.1f ms\nSubmit: %.1f ms\nEntities: %u\nProjectiles: %d\nDraw calls: %d\n", dt*1000.0, last_frame_processing_time*1000.0, frame_input.submit_time*1000.0, num_alive_entities, projectiles.count, frame_input.num_draw_calls);
+   for(int i = 0; i < PASS_LAST; i++) stats = tprint("%s%s: %.2f ms\n", stats, pass_names[i], pass_times[i]*1000.0);
    AABB bounds = draw_text(false, true, stats, pos, BLACK, 1.0f);
    pos.Y -= bounds.upper_left.Y - screen_size().Y;
    bounds = draw_text(false, true, stats, pos, BLACK, 1.0f);
    // background panel
    colorquad(false, quad_aabb(bounds), (Color){1.0, 1.0, 1.0, 0.3f});
    draw_text(false, false, stats, pos, BLACK, 1.0f);
-   num_draw_calls = 0;
   }
 #endif // devtools
 
-  // entities
-  ENTITIES_ITER(entities)
+  // the simulation runs at TICK_RATE no matter the frame rate, as many ticks as fit
+  // in the time that's passed. Drawn in between the last two ticks, so it's smooth
+  // when they don't line up with frames
+  for(int i = 0; i < PASS_LAST; i++) pass_times[i] = 0.0;
+#ifdef DEVTOOLS
+  // between ticks, where snapshots have to be taken
+  if(frame_input.quicksave)
   {
-   if(it->kind == ENTITY_OLD_MAN)
+   if(quicksave == NULL)
    {
-    if(it->aggressive)
-    {
-     Entity *targeting = player;
-     it->shotgun_timer += dt;
-     Vec2 to_player = NormV2(SubV2(targeting->pos, it->pos));
-     if(it->shotgun_timer >= 1.0f)
-     {
-      it->shotgun_timer = 0.0f;
-      const float spread = (float)PI/4.0f;
-      // shoot shotgun
-      for(int i = 0; i < 3; i++)
-      {
-       Vec2 dir = to_player;
-       float theta = Lerp(-spread/2.0f, ((float)i / 2.0f), spread/2.0f);
-       dir = RotateV2(dir, theta);
-       Entity *new_bullet = new_entity();
-       new_bullet->kind = ENTITY_BULLET;
-       new_bullet->pos = AddV2(it->pos, MulV2F(dir, 20.0f));
-       new_bullet->vel = MulV2F(dir, 10.0f);
-       it->vel = AddV2(it->vel, MulV2F(dir, -3.0f));
-      }
-     }
-
-     Vec2 target_vel = NormV2(AddV2(rotate_counter_clockwise(to_player), MulV2F(to_player, 0.5f)));
-     target_vel = MulV2F(target_vel, 3.0f);
-     it->vel = LerpV2(it->vel, 15.0f * dt, target_vel);
-     it->pos = move_and_slide(it, it->pos, MulV2F(it->vel, pixels_per_meter * dt));
-    }
-    draw_animated_sprite(&old_man_idle, elapsed_time, false, it->pos, WHITE);
-   }
-   else if (it->kind == ENTITY_BULLET)
-   {
-    it->pos = AddV2(it->pos, MulV2F(it->vel, pixels_per_meter * dt));
-    draw_quad(true, quad_aabb(entity_aabb(it)), image_white_square, full_region(image_white_square), WHITE);
-    Overlapping over = get_overlapping(cur_level, entity_aabb(it));
-    Entity *from_bullet = it;
-    BUFF_ITER(Overlap, &over) if(it->e != from_bullet)
-    {
-     if(!it->is_tile)
-     {
-      // knockback and damage
-      Entity *hit = it->e;
-      if(hit->kind == ENTITY_OLD_MAN) hit->aggressive = true;
-      hit->vel = MulV2F(NormV2(SubV2(hit->pos, from_bullet->pos)), 5.0f);
-      hit->damage += 0.2f;
-      *from_bullet = (Entity){0};
-     }
-    }
-    if(!has_point(level_aabb, it->pos)) *it = (Entity){0};
-   }
-   else if(it->kind == ENTITY_PLAYER)
-   {
-   }
-   else
-   {
-    assert(false);
+    // the camera and the time into the next tick go back with the world
+    add_snapshot_region(&cam, sizeof(cam));
+    add_snapshot_region(&tick_accumulator, sizeof(tick_accumulator));
+    add_snapshot_region(&elapsed_time, sizeof(elapsed_time));
+    quicksave = malloc(snapshot_size()*sizeof(uint64_t));
    }
+   save_snapshot(quicksave);
   }
-
-  // process player character
+  if(frame_input.quickload && quicksave != NULL) load_snapshot(quicksave);
+#endif
+  tick_accumulator += dt_double;
+  while(tick_accumulator >= TICK_DT)
   {
-   Vec2 character_sprite_pos = AddV2(player->pos, V2(0.0, 20.0f));
-
-   if(attack && (player->state == CHARACTER_IDLE || player->state == CHARACTER_WALKING))
-   {
-    player->state = CHARACTER_ATTACK;
-    player->swing_progress = 0.0;
-   }
-
-   // rolling
-   if(roll && !player->is_rolling && player->time_not_rolling > 0.3f && (player->state == CHARACTER_IDLE || player->state == CHARACTER_WALKING))
-   {
-    player->is_rolling = true;
-    player->roll_progress = 0.0;
-    player->speed = PLAYER_ROLL_SPEED;
-   }
-   if(player->state != CHARACTER_IDLE && player->state != CHARACTER_WALKING)
-   {
-    player->roll_progress = 0.0;
-    player->is_rolling = false;
-   }
-   if(player->is_rolling)
-   {
-    player->time_not_rolling = 0.0f;
-    player->roll_progress += dt;
-    if(player->roll_progress > anim_sprite_duration(&knight_rolling))
-    {
-     player->is_rolling = false;
-    }
-   }
-   if(!player->is_rolling) player->time_not_rolling += dt;
-
-   cam.pos = LerpV2(cam.pos, dt*8.0f, MulV2F(player->pos, -1.0f * cam.scale));
-   if(player->state == CHARACTER_WALKING)
-   {
-    if(player->speed <= 0.01f) player->speed = PLAYER_SPEED;
-    player->speed = Lerp(player->speed, dt * 3.0f, PLAYER_SPEED);
-    player->pos = move_and_slide(player, player->pos, MulV2F(movement, dt * pixels_per_meter * player->speed));
-    if(player->is_rolling)
-    {
-     draw_animated_sprite(&knight_rolling, player->roll_progress, player->facing_left, character_sprite_pos, WHITE);
-    }
-    else
-    {
-     draw_animated_sprite(&knight_running, elapsed_time, player->facing_left, character_sprite_pos, WHITE);
-    }
-
-    if(LenV2(movement) == 0.0)
-    {
-     player->state = CHARACTER_IDLE;
-    }
-    else
-    {
-     player->facing_left = movement.X < 0.0f;
-    }
-   }
-   else if(player->state == CHARACTER_IDLE)
-   {
-    if(player->is_rolling)
-    {
-     draw_animated_sprite(&knight_rolling, player->roll_progress, player->facing_left, character_sprite_pos, WHITE);
-    }
-    else
-    {
-     draw_animated_sprite(&knight_idle, elapsed_time, player->facing_left, character_sprite_pos, WHITE);
-    }
-    if(LenV2(movement) > 0.01) player->state = CHARACTER_WALKING;
-   }
-   else if(player->state == CHARACTER_ATTACK)
-   {
-    AABB weapon_aabb = {0};
-    if(player->facing_left)
-    {
-     weapon_aabb = (AABB){
-      .upper_left = AddV2(player->pos, V2(-40.0, 25.0)),
-      .lower_right = AddV2(player->pos, V2(0.0, -25.0)),
-     };
-    }
-    else
-    {
-     weapon_aabb = (AABB){
-      .upper_left = AddV2(player->pos, V2(0.0, 25.0)),
-      .lower_right = AddV2(player->pos, V2(40.0, -25.0)),
-     };
-    }
-    dbgrect(weapon_aabb);
-    Overlapping overlapping_weapon = get_overlapping(cur_level, weapon_aabb);
-    BUFF_ITER(Overlap, &overlapping_weapon)
-    {
-     if(!it->is_tile)
-     {
-      Entity *e = it->e;
-      if(e->kind == ENTITY_OLD_MAN)
-      {
-       e->aggressive = true;
-      }
-     }
-    }
-
-    player->swing_progress += dt;
-    draw_animated_sprite(&knight_attack, player->swing_progress, player->facing_left, character_sprite_pos, WHITE);
-    if(player->swing_progress > anim_sprite_duration(&knight_attack))
-    {
-     player->state = CHARACTER_IDLE;
-    }
-   }
-
-   // health
-   if(player->damage >= 1.0)
-   {
-    reset_level();
-   }
-   else
-   {
-    draw_quad(false, (Quad){.ul=V2(0.0f, screen_size().Y), .ur = screen_size(), .lr = V2(screen_size().X, 0.0f)}, image_hurt_vignette, full_region(image_hurt_vignette), (Color){1.0f, 1.0f, 1.0f, player->damage});
-   }
+   record_tick(frame_input.keys);
+   tick(input_from_keys(frame_input.keys), (float)TICK_DT);
+   tick_accumulator -= TICK_DT;
   }
+  float alpha = (float)(tick_accumulator / TICK_DT);
+#ifdef DEVTOOLS
+  BUFF_ITER(AABB, &debug_rects) dbgrect(*it);
+#endif
+
+  uint64_t pass_start = stm_now();
+  Entity *player = get_entity(player_handle);
+  assert(player != NULL);
+  cam.pos = LerpV2(cam.pos, dt*8.0f, MulV2F(interpolated_pos(player, alpha), -1.0f * cam.scale));
+  draw_old_men(alpha);
+  draw_projectiles(alpha);
+  draw_characters(alpha);
+  draw_quad(false, (Quad){.ul=V2(0.0f, screen_size().Y), .ur = screen_size(), .lr = V2(screen_size().X, 0.0f)}, images[IMAGE_HURT_VIGNETTE], full_region(images[IMAGE_HURT_VIGNETTE]), (Color){1.0f, 1.0f, 1.0f, player->damage});
+  end_pass(PASS_RENDER, &pass_start);
 
   // do dialog
   AABB dialog_rect = centered_aabb(player->pos, V2(TILE_SIZE*2.0f, TILE_SIZE*2.0f));
   dbgrect(dialog_rect);
-  Overlapping possible_dialogs = get_overlapping(cur_level, dialog_rect);
+  Overlapping possible_dialogs = get_overlapping(cur_level, dialog_rect, (OverlapFilter){ .no_tiles = true, .predicate = can_talk_to });
   Entity *closest_talkto = NULL;
   float closest_talkto_dist = INFINITY;
-  BUFF_ITER(Overlap, &possible_dialogs)
+  SPAN_ITER(Overlap, &possible_dialogs)
   {
-   if(!it->is_tile && it->e->kind == ENTITY_OLD_MAN && !it->e->aggressive)
+   float dist = LenV2(SubV2(it->e->pos, player->pos));
+   if(dist < closest_talkto_dist)
    {
-    float dist = LenV2(SubV2(it->e->pos, player->pos));
-    if(dist < closest_talkto_dist)
-    {
-     closest_talkto_dist = dist;
-     closest_talkto = it->e;
-    }
+    closest_talkto_dist = dist;
+    closest_talkto = it->e;
    }
   }
   if(closest_talkto != NULL)
   {
-   draw_quad(true, quad_centered(closest_talkto->pos, V2(TILE_SIZE, TILE_SIZE)), image_dialog_circle, full_region(image_dialog_circle), WHITE);
+   draw_quad(true, quad_centered(closest_talkto->pos, V2(TILE_SIZE, TILE_SIZE)), images[IMAGE_DIALOG_CIRCLE], full_region(images[IMAGE_DIALOG_CIRCLE]), WHITE);
 
    Dialog dialog = {
     .sentences[0].text = "I'm an old man. fjdslfdasljfla dsfjdsalkf adskjfdlskfkladsjfkljdskljsadlkfjdsaklfjldsajf",
@@ -1527,17 +1142,116 @@ void frame(void)
    dbgrect(dialog_panel);
   }
 
-  flush_quad_batch();
-  sg_end_pass();
-  sg_commit();
-
   last_frame_processing_time = stm_sec(stm_diff(stm_now(),time_start_frame));
 
   reset(&scratch);
 }
 
+// frames are pipelined, the sim thread builds the next frame while the main thread
+// submits the one before it. So what's on screen is a frame behind the input
+#ifndef NO_THREADS
+Semaphore frame_requested; // main -> sim, frame_input and recording are ready
+Semaphore frame_built; // sim -> main, recording is done and the sim thread is idle
+bool sim_thread_started = false;
+
+void sim_thread(void *arg)
+{
+ (void)arg;
+ while(true)
+ {
+  semaphore_wait(&frame_requested);
+  build_frame();
+  semaphore_signal(&frame_built);
+ }
+}
+#endif
+
+void frame(void)
+{
+ // a replay runs instead of the game, before the sim thread starts
+ if(replay_path != NULL)
+ {
+  replay();
+  exit(0);
+ }
+
+ // input for the next frame, only read here on the main thread
+ FrameInput next = {0};
+ {
+  next.dt = stm_sec(stm_diff(stm_now(), last_frame_time));
+  next.dt = fmin(next.dt, 5.0 / 60.0); // clamp dt at maximum 5 frames, avoid super huge dt
+  last_frame_time = stm_now();
+
+  next.keys = 0;
+  if(keydown[SAPP_KEYCODE_D]) next.keys |= INPUT_RIGHT;
+  if(keydown[SAPP_KEYCODE_A]) next.keys |= INPUT_LEFT;
+  if(keydown[SAPP_KEYCODE_W]) next.keys |= INPUT_UP;
+  if(keydown[SAPP_KEYCODE_S]) next.keys |= INPUT_DOWN;
+  if(keydown[SAPP_KEYCODE_J]) next.keys |= INPUT_ATTACK;
+  if(keydown[SAPP_KEYCODE_K]) next.keys |= INPUT_ROLL;
+  next.mouse_pos = mouse_pos;
+  next.screen_size = V2((float)sapp_width(), (float)sapp_height());
+  next.num_draw_calls = num_draw_calls;
+  next.submit_time = last_frame_submit_time;
+#ifdef DEVTOOLS
+  next.quicksave = quicksave_pressed;
+  next.quickload = quickload_pressed;
+  quicksave_pressed = false;
+  quickload_pressed = false;
+#endif
+ }
+
+ // there's nobody else to run the loading jobs without workers, so a job a frame here
+ if(num_workers == 1) run_background_job();
+
+ DrawList *to_submit = recording;
+#ifdef NO_THREADS
+ upload_loaded_images();
+ upload_loaded_font();
+ frame_input = next;
+ build_frame();
+#else
+ if(sim_thread_started)
+ {
+  semaphore_wait(&frame_built);
+ }
+ else
+ {
+  // nothing's been built yet, the first frame is empty
+  semaphore_init(&frame_requested);
+  semaphore_init(&frame_built);
+  if(!start_thread(sim_thread, NULL))
+  {
+   fprintf(stderr, "Couldn't start the simulation thread\n");
+   exit(1);
+  }
+  sim_thread_started = true;
+ }
+ // the sim thread's idle until it's signaled, it can't be drawing with them
+ upload_loaded_images();
+ upload_loaded_font();
+ to_submit = recording;
+ recording = recording == &draw_lists[0] ? &draw_lists[1] : &draw_lists[0];
+ frame_input = next;
+ semaphore_signal(&frame_requested);
+#endif
+
+ uint64_t time_start_submit = stm_now();
+ sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
+ sg_apply_pipeline(state.pip);
+ num_draw_calls = submit_draw_list(to_submit);
+ sg_end_pass();
+ sg_commit();
+ last_frame_submit_time = stm_sec(stm_diff(stm_now(), time_start_submit));
+}
+
 void cleanup(void)
 {
+#ifndef NO_THREADS
+ // the sim thread queries images, let it finish before they go away
+ if(sim_thread_started) semaphore_wait(&frame_built);
+#endif
+ stop_recording();
  sg_shutdown();
 }
 
@@ -1556,6 +1270,8 @@ void event(const sapp_event *e)
   {
    mouse_frozen = !mouse_frozen;
   }
+  if(e->key_code == SAPP_KEYCODE_F5) quicksave_pressed = true;
+  if(e->key_code == SAPP_KEYCODE_F9) quickload_pressed = true;
 #endif
  }
  if(e->type == SAPP_EVENTTYPE_KEY_UP)
@@ -1574,7 +1290,14 @@ void event(const sapp_event *e)
 
 sapp_desc sokol_main(int argc, char* argv[])
 {
- (void)argc; (void)argv;
+ // --record file saves every tick's input, --replay file plays one back as fast as
+ // possible and quits
+ for(int i = 1; i + 1 < argc; i++)
+ {
+  if(strcmp(argv[i], "--record") == 0) record_path = argv[++i];
+  else if(strcmp(argv[i], "--replay") == 0) replay_path = argv[++i];
+ }
+ if(record_path != NULL && replay_path == NULL) start_recording();
  return (sapp_desc){
   .init_cb = init,
    .frame_cb = frame,
@@ -0,0 +1,2290 @@
+// the game without drawing or windows: entities, collision, levels and AI, stepped a
+// tick at a time. main.c draws it and headless.c runs it on its own. The only sokol it
+// needs is sokol_time, which has to be included, with its implementation, before this
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "HandmadeMath.h"
+#include "jobs.c"
+#include "level_format.h"
+
+#pragma warning(disable : 4996) // fopen is safe. I don't care about fopen_s
+
+// for overlap_mask
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#define ARRLEN(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
+#define ENTITIES_ITER(ents) for(Entity *it = ents; it < ents + ARRLEN(ents); it++) if(it->exists)
+
+// so can be grep'd and removed
+#define dbgprint(...) { printf("Debug | %s:%d | ", __FILE__, __LINE__); printf(__VA_ARGS__); }
+Vec2 RotateV2(Vec2 v, float theta)
+{
+  return V2( 
+      v.X * cosf(theta) - v.Y * sinf(theta),
+      v.X * sinf(theta) + v.Y * cosf(theta)
+    );
+}
+
+typedef struct AABB
+{
+ Vec2 upper_left;
+ Vec2 lower_right;
+} AABB;
+
+typedef struct TileCoord
+{
+ int x;
+ int y;
+} TileCoord;
+
+typedef struct TileInstance
+{
+ uint16_t kind;
+} TileInstance;
+
+typedef struct AnimatedTile
+{
+ uint16_t id_from;
+ int num_frames;
+ uint16_t frames[32];
+} AnimatedTile;
+
+// per tile id properties, set in tiled or assets.mdesk and baked by codegen
+typedef enum TileFlags
+{
+ TILE_SOLID = 1 << 0,
+ TILE_COLLISION_SHAPE = 1 << 1, // has a collision shape in tiled, still collides as a full tile
+} TileFlags;
+
+#include "image_ids.gen.h" // ImageId, one for each @image in assets.mdesk. The images themselves are only loaded when drawing
+
+typedef struct TileSet
+{
+ ImageId img;
+ AnimatedTile animated[128];
+ int num_tiles;
+ uint8_t *flags; // TileFlags indexed by tile id in the tileset, which is one less than the level's tile kind
+} TileSet;
+
+typedef struct AnimatedSprite
+{
+ ImageId img;
+ double time_per_frame;
+ int num_frames;
+ Vec2 start;
+ float horizontal_diff_btwn_frames;
+ Vec2 region_size;
+ bool no_wrap; // does not wrap when playing
+} AnimatedSprite;
+
+typedef enum CharacterState
+{
+ CHARACTER_WALKING,
+ CHARACTER_IDLE,
+ CHARACTER_ATTACK,
+} CharacterState;
+
+#include "entity_kinds.gen.h" // EntityKind, one for each @entity in assets.mdesk
+
+// what's the same for every entity of a kind, from its @entity block in assets.mdesk.
+// Fields a kind doesn't use are zero
+typedef struct EntityArchetype
+{
+ Vec2 size; // of the collision box
+ float speed; // meters per second
+ Vec2 sprite_offset; // from the entity's position
+
+ AnimatedSprite *idle;
+ AnimatedSprite *running;
+ AnimatedSprite *rolling;
+ AnimatedSprite *attack;
+
+ // player
+ float roll_speed;
+
+ // shooting
+ float fire_interval; // seconds
+ int shots; // fanned out evenly across the spread
+ float spread; // radians
+ float projectile_speed;
+ float muzzle_distance; // how far away projectiles spawn
+ float recoil; // how much each shot pushes back the shooter
+} EntityArchetype;
+
+extern const EntityArchetype archetypes[ENTITY_LAST]; // in sim.gen.c, indexed by kind
+
+// only the fields every entity has, so loops over all of them stay small. Anything
+// specific to a kind lives in that kind's component table, at index `component`
+typedef struct Entity
+{
+ bool exists;
+ bool intangible; // nothing collides with or hits it, like the player while rolling
+ EntityKind kind;
+
+ Vec2 pos;
+ Vec2 prev_pos; // before the last tick, for drawing in between ticks
+ Vec2 vel; // only used sometimes, like in old man
+ float damage; // at 1.0, he's dead
+ uint32_t component;
+} Entity;
+
+typedef struct OldMan
+{
+ uint32_t entity; // index into entities
+ bool aggressive;
+ double shotgun_timer;
+} OldMan;
+
+typedef struct Character
+{
+ uint32_t entity; // index into entities
+ CharacterState state;
+ bool facing_left;
+ bool is_rolling; // can only roll in idle or walk states
+ float speed; // for lerping to the speed, so that roll gives speed boost which fades
+ double time_not_rolling; // for cooldown for roll, so you can't just hold it and be invincible
+ double roll_progress;
+ double swing_progress;
+} Character;
+
+typedef struct Overlap
+{
+ bool is_tile; // in which case e will be null, naturally
+ TileCoord tile;
+ Entity *e;
+} Overlap;
+
+#define BUFF(type, max_size) struct { type data[max_size]; int cur_index; }
+#define BUFF_APPEND(buff_ptr, element)  { (buff_ptr)->data[(buff_ptr)->cur_index++] = element; assert((buff_ptr)->cur_index < ARRLEN((buff_ptr)->data)); }
+#define BUFF_ITER(type, buff_ptr) for(type *it = &((buff_ptr)->data[0]); it < (buff_ptr)->data + (buff_ptr)->cur_index; it++)
+
+// like a BUFF but the data lives somewhere else, usually the scratch arena, so there's no max size
+#define SPAN(type) struct { type *data; int count; }
+#define SPAN_ITER(type, span_ptr) for(type *it = (span_ptr)->data; it < (span_ptr)->data + (span_ptr)->count; it++)
+
+typedef SPAN(Overlap) Overlapping;
+typedef SPAN(Entity *) EntitySpan;
+typedef SPAN(TileCoord) TileCoordSpan;
+
+#define TILE_SIZE 32 // in pixels
+#ifndef MAX_ENTITIES
+#define MAX_ENTITIES 4096 // can be overridden when compiling. Every per-entity table is a static array this long, so memory grows with it
+#endif
+#ifndef TICK_RATE
+#define TICK_RATE 60 // simulation steps per second, can be overridden when compiling
+#endif
+#define TICK_DT (1.0/(double)TICK_RATE)
+#define LARGEST_ENTITY_SIZE TILE_SIZE // biggest entity_aabb_size, how far the broadphase looks around queries
+#define SOLID_WORDS_PER_ROW(width) (((width) + 63)/64)
+typedef struct Level
+{
+ const char *filepath; // baked by codegen, see level_format.h. Loaded the first time the level is
+ uint8_t *file; // all of it, the solidity and chunks are used from here in place
+ int width; // in tiles
+ int height;
+ const uint64_t *solid; // bit per tile, SOLID_WORDS_PER_ROW words a row, generated from the tileset's TILE_SOLID flags
+ const uint32_t *chunk_offsets; // in file, of each chunk's LevelFileRuns and then the end of the last
+ Entity initial_entities[MAX_LEVEL_ENTITIES]; // shouldn't be directly modified, only used to initialize entities on loading of level
+} Level;
+
+typedef struct Arena
+{
+ char *data;
+ size_t data_size;
+ size_t cur;
+} Arena;
+
+Arena make_arena(size_t max_size)
+{
+ return (Arena)
+ {
+  .data = calloc(max_size, 1),
+  .data_size = max_size,
+  .cur = 0,
+ };
+}
+
+void reset(Arena *a)
+{
+ memset(a->data, 0, a->cur); // only what was used, everything after is still zero
+ a->cur = 0;
+}
+
+#define ARENA_ALIGNMENT 16
+// sizes are rounded up so everything stays aligned, and taken with an atomic add so
+// jobs on other threads can allocate from the same arena. Resetting isn't thread safe
+char *get(Arena *a, size_t of_size)
+{
+ assert(a->data != NULL);
+ size_t size = (of_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+ size_t at = atomic_add_size(&a->cur, size);
+ assert(at + size < a->data_size);
+ return a->data + at;
+}
+
+#define ARENA_PUSH(arena, type, count) ((type *)get(arena, sizeof(type) * (size_t)(count)))
+
+Arena scratch = {0};
+
+char *tprint(const char *format, ...)
+{
+ va_list argptr;
+ va_start(argptr, format);
+
+ int size = vsnprintf(NULL, 0, format, argptr) + 1; // for null terminator
+
+ char *to_return = get(&scratch, size);
+
+ vsnprintf(to_return, size, format, argptr);
+
+  va_end(argptr);
+
+  return to_return;
+}
+
+// the simulation doesn't draw, but it's handy to see the boxes it checks. These are
+// from the last tick, the game draws them when it has devtools
+#ifdef DEVTOOLS
+BUFF(AABB, 1024*4) debug_rects = {0};
+#define sim_dbgrect(rect) { if(debug_rects.cur_index + 1 < ARRLEN(debug_rects.data)) BUFF_APPEND(&debug_rects, rect); }
+#else
+#define sim_dbgrect(rect) {}
+#endif
+
+Vec2 entity_aabb_size(Entity *e)
+{
+ return archetypes[e->kind].size;
+}
+
+// tilecoord is integer tile position, not like tile coord
+Vec2 tilecoord_to_world(TileCoord t)
+{
+ return V2( (float)t.x * (float)TILE_SIZE * 1.0f, -(float)t.y * (float)TILE_SIZE * 1.0f );
+}
+
+// points from tiled editor have their own strange and alien coordinate system (local to the tilemap Y+ down)
+Vec2 tilepoint_to_world(Vec2 tilepoint)
+{
+ Vec2 tilecoord = MulV2F(tilepoint, 1.0/TILE_SIZE);
+ return tilecoord_to_world((TileCoord){(int)tilecoord.X, (int)tilecoord.Y});
+}
+
+TileCoord world_to_tilecoord(Vec2 w)
+{
+ // world = V2(tilecoord.x * tile_size, -tilecoord.y * tile_size)
+ // world.x = tilecoord.x * tile_size
+ // world.x / tile_size = tilecoord.x
+ // world.y = -tilecoord.y * tile_size
+ // - world.y / tile_size = tilecoord.y
+ return (TileCoord){ (int)floorf(w.X / TILE_SIZE), (int)floorf(-w.Y / TILE_SIZE) };
+}
+
+
+AABB tile_aabb(TileCoord t)
+{
+ return (AABB)
+ {
+  .upper_left = tilecoord_to_world(t),
+   .lower_right = AddV2(tilecoord_to_world(t), V2(TILE_SIZE, -TILE_SIZE)),
+ };
+}
+
+Vec2 rotate_counter_clockwise(Vec2 v)
+{
+ return V2(-v.Y, v.X);
+}
+
+Vec2 aabb_center(AABB aabb)
+{
+ return MulV2F(AddV2(aabb.upper_left, aabb.lower_right), 0.5f);
+}
+
+AABB centered_aabb(Vec2 at, Vec2 size)
+{
+ return (AABB){
+  .upper_left  = AddV2(at, V2(-size.X/2.0f, size.Y/2.0f)),
+   .lower_right = AddV2(at, V2( size.X/2.0f, -size.Y/2.0f)),
+ };
+}
+
+AABB entity_aabb(Entity *e)
+{
+ return centered_aabb(e->pos, entity_aabb_size(e));
+}
+
+bool in_level(Level *l, TileCoord t)
+{
+ return t.x >= 0 && t.x < l->width && t.y >= 0 && t.y < l->height;
+}
+
+// outside of the level is solid, so nothing can leave it
+bool is_solid(Level *l, TileCoord t)
+{
+ if(!in_level(l, t)) return true;
+ return (l->solid[t.y*SOLID_WORDS_PER_ROW(l->width) + t.x / 64] >> (t.x % 64)) & 1;
+}
+
+int lowest_set_bit(uint64_t bits)
+{
+ assert(bits != 0);
+#ifdef _MSC_VER
+ unsigned long index;
+ _BitScanForward64(&index, bits);
+ return (int)index;
+#else
+ return __builtin_ctzll(bits);
+#endif
+}
+
+int count_set_bits(uint64_t bits)
+{
+#ifdef _MSC_VER
+ return (int)__popcnt64(bits);
+#else
+ return __builtin_popcountll(bits);
+#endif
+}
+
+// inclusive range of tiles, from is the upper left
+typedef struct TileRange
+{
+ TileCoord from;
+ TileCoord to;
+} TileRange;
+
+// the tiles an aabb covers. Tiles it only touches the edge of aren't included,
+// same as overlapping() doesn't count touching
+TileRange aabb_tile_range(AABB aabb)
+{
+ TileRange to_return = {
+  .from = { (int)floorf(aabb.upper_left.X / TILE_SIZE), (int)floorf(-aabb.upper_left.Y / TILE_SIZE) },
+  .to = { (int)ceilf(aabb.lower_right.X / TILE_SIZE) - 1, (int)ceilf(-aabb.lower_right.Y / TILE_SIZE) - 1 },
+ };
+ // zero size boxes are still in a tile
+ if(to_return.to.x < to_return.from.x) to_return.to.x = to_return.from.x;
+ if(to_return.to.y < to_return.from.y) to_return.to.y = to_return.from.y;
+ return to_return;
+}
+
+// bits from_bit to to_bit inclusive, both within the word
+uint64_t bit_range_mask(int from_bit, int to_bit)
+{
+ uint64_t up_to_to = to_bit >= 63 ? ~0ull : ((1ull << (to_bit + 1)) - 1);
+ return up_to_to & ~((1ull << from_bit) - 1);
+}
+
+// every solid tile the aabb covers, each once, allocated from the scratch arena.
+// Scans the level's solidity bitset a word (64 tiles) at a time, once to count the
+// tiles and then again to write them. Tiles outside the level count as solid
+TileCoordSpan solid_tiles_in_aabb(Level *l, AABB aabb)
+{
+ TileRange range = aabb_tile_range(aabb);
+ TileCoordSpan to_return = {0};
+ for(int pass = 0; pass < 2; pass++)
+ {
+  int num_out = 0;
+#define OUTPUT_TILE(tile_x, tile_y) { if(pass == 1) to_return.data[num_out] = (TileCoord){tile_x, tile_y}; num_out++; }
+  for(int y = range.from.y; y <= range.to.y; y++)
+  {
+   if(y < 0 || y >= l->height)
+   {
+    for(int x = range.from.x; x <= range.to.x; x++) OUTPUT_TILE(x, y);
+    continue;
+   }
+   for(int x = range.from.x; x < 0 && x <= range.to.x; x++) OUTPUT_TILE(x, y);
+
+   int from_x = range.from.x < 0 ? 0 : range.from.x;
+   int to_x = range.to.x >= l->width ? l->width - 1 : range.to.x;
+   if(from_x <= to_x)
+   {
+    for(int word = from_x / 64; word <= to_x / 64; word++)
+    {
+     int from_bit = word == from_x / 64 ? from_x % 64 : 0;
+     int to_bit = word == to_x / 64 ? to_x % 64 : 63;
+     uint64_t bits = l->solid[y*SOLID_WORDS_PER_ROW(l->width) + word] & bit_range_mask(from_bit, to_bit);
+     if(pass == 0)
+     {
+      num_out += count_set_bits(bits);
+      continue;
+     }
+     while(bits != 0)
+     {
+      OUTPUT_TILE(word*64 + lowest_set_bit(bits), y);
+      bits &= bits - 1; // clear lowest set bit
+     }
+    }
+   }
+
+   for(int x = l->width > range.from.x ? l->width : range.from.x; x <= range.to.x; x++) OUTPUT_TILE(x, y);
+  }
+#undef OUTPUT_TILE
+  if(pass == 0) to_return.data = ARENA_PUSH(&scratch, TileCoord, num_out);
+  to_return.count = num_out;
+ }
+ return to_return;
+}
+
+// same as solid_tiles_in_aabb but stops at the first one
+bool any_solid_tile_in_aabb(Level *l, AABB aabb)
+{
+ TileRange range = aabb_tile_range(aabb);
+ if(range.from.x < 0 || range.from.y < 0 || range.to.x >= l->width || range.to.y >= l->height) return true;
+ for(int y = range.from.y; y <= range.to.y; y++)
+ {
+  for(int word = range.from.x / 64; word <= range.to.x / 64; word++)
+  {
+   int from_bit = word == range.from.x / 64 ? range.from.x % 64 : 0;
+   int to_bit = word == range.to.x / 64 ? range.to.x % 64 : 63;
+   if(l->solid[y*SOLID_WORDS_PER_ROW(l->width) + word] & bit_range_mask(from_bit, to_bit)) return true;
+  }
+ }
+ return false;
+}
+
+// the level's tiles are drawn from chunks, loaded on worker threads around the camera
+// and kept in a small cache, so drawing and memory only depend on what's near the
+// camera, not how big the level is. The simulation only needs the solidity bits, which
+// are always there, so what's loaded never changes what happens
+#define CHUNK_TILES LEVEL_CHUNK_TILES // along a side, same as they're compressed in
+#define MAX_CHUNKS 64 // loaded at once, a lot more than fit around the camera
+
+typedef struct Chunk
+{
+ Level *level; // NULL for an unused slot
+ TileCoord coord; // in chunks
+ JobCounter loading; // the tiles are ready when it's zero
+ uint64_t last_wanted; // stream_chunks call it was last near the camera in, the oldest is reused first
+ TileInstance tiles[CHUNK_TILES][CHUNK_TILES];
+} Chunk;
+
+Chunk chunks[MAX_CHUNKS] = {0};
+uint64_t num_chunk_streams = 0;
+
+// only ever touched by the thread streaming them, besides the job loading each
+Chunk *find_chunk(Level *l, TileCoord coord)
+{
+ for(int i = 0; i < MAX_CHUNKS; i++)
+ {
+  if(chunks[i].level == l && chunks[i].coord.x == coord.x && chunks[i].coord.y == coord.y) return &chunks[i];
+ }
+ return NULL;
+}
+
+void load_chunk_job(void *data, int from, int to)
+{
+ (void)from;
+ (void)to;
+ Chunk *c = data;
+ Level *l = c->level;
+ int chunks_wide = (l->width + CHUNK_TILES - 1)/CHUNK_TILES;
+ int chunk_index = c->coord.y*chunks_wide + c->coord.x;
+ const LevelFileRun *run = (const LevelFileRun *)(l->file + l->chunk_offsets[chunk_index]);
+ const LevelFileRun *end = (const LevelFileRun *)(l->file + l->chunk_offsets[chunk_index + 1]);
+ TileInstance *out = &c->tiles[0][0];
+ for(; run < end; run++) // level_file_ok made sure they add up to exactly the chunk
+ {
+  for(int i = 0; i < run->count; i++) *out++ = (TileInstance){ .kind = run->kind };
+ }
+}
+
+// rounds down for negative numbers too, unlike /
+int floor_div(int a, int b)
+{
+ return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+// the chunks covering the tiles and margin more chunks around them, that are inside the level
+TileRange level_chunk_range(Level *l, TileRange tiles, int margin)
+{
+ TileRange to_return = {
+  .from = { floor_div(tiles.from.x, CHUNK_TILES) - margin, floor_div(tiles.from.y, CHUNK_TILES) - margin },
+  .to = { floor_div(tiles.to.x, CHUNK_TILES) + margin, floor_div(tiles.to.y, CHUNK_TILES) + margin },
+ };
+ int chunks_wide = (l->width + CHUNK_TILES - 1)/CHUNK_TILES;
+ int chunks_high = (l->height + CHUNK_TILES - 1)/CHUNK_TILES;
+ if(to_return.from.x < 0) to_return.from.x = 0;
+ if(to_return.from.y < 0) to_return.from.y = 0;
+ if(to_return.to.x >= chunks_wide) to_return.to.x = chunks_wide - 1;
+ if(to_return.to.y >= chunks_high) to_return.to.y = chunks_high - 1;
+ return to_return;
+}
+
+// starts loading the chunks in view and one more all around it, in place of the ones
+// that have been out of view the longest. Then waits for any in view that still
+// aren't loaded, which only happens when the view jumps somewhere. With no worker
+// threads nothing loads in the background, so only the ones in view are loaded, then
+void stream_chunks(Level *l, AABB view)
+{
+ num_chunk_streams += 1;
+ TileRange in_view = level_chunk_range(l, aabb_tile_range(view), 0);
+ TileRange wanted = level_chunk_range(l, aabb_tile_range(view), num_workers > 1 ? 1 : 0);
+ for(int pass = 0; pass < 2; pass++)
+ {
+  // the ones in view get slots first
+  TileRange range = pass == 0 ? in_view : wanted;
+  for(int y = range.from.y; y <= range.to.y; y++)
+  {
+   for(int x = range.from.x; x <= range.to.x; x++)
+   {
+    TileCoord coord = { x, y };
+    Chunk *c = find_chunk(l, coord);
+    if(c == NULL)
+    {
+     for(int i = 0; i < MAX_CHUNKS; i++)
+     {
+      Chunk *candidate = &chunks[i];
+      if(candidate->level != NULL && (candidate->last_wanted == num_chunk_streams || atomic_load_long(&candidate->loading.remaining) > 0)) continue;
+      if(c == NULL || candidate->last_wanted < c->last_wanted) c = candidate;
+     }
+     if(c == NULL) continue; // every slot's in use this frame, the view's huge
+     c->level = l;
+     c->coord = coord;
+     parallel_for_async(&c->loading, 1, 1, load_chunk_job, c);
+    }
+    c->last_wanted = num_chunk_streams;
+   }
+  }
+ }
+
+ for(int y = in_view.from.y; y <= in_view.to.y; y++)
+ {
+  for(int x = in_view.from.x; x <= in_view.to.x; x++)
+  {
+   Chunk *c = find_chunk(l, (TileCoord){ x, y });
+   if(c != NULL) wait_for_counter(&c->loading);
+  }
+ }
+}
+
+// nothing for tiles whose chunk isn't loaded, or that are outside of the level
+TileInstance get_tile(Level *l, TileCoord t)
+{
+ if(!in_level(l, t)) return (TileInstance){0};
+ Chunk *c = find_chunk(l, (TileCoord){ t.x/CHUNK_TILES, t.y/CHUNK_TILES });
+ if(c == NULL || atomic_load_long(&c->loading.remaining) > 0) return (TileInstance){0};
+ return c->tiles[t.y % CHUNK_TILES][t.x % CHUNK_TILES];
+}
+
+#include "sim.gen.c"
+
+// for asking about a tile kind rather than a spot in a level, which is_solid is for
+bool is_tile_solid(TileSet *tileset, TileInstance t)
+{
+ if(t.kind == 0) return true; // no tile
+ int tile_id = t.kind - 1;
+ if(tile_id >= tileset->num_tiles) return false;
+ return (tileset->flags[tile_id] & TILE_SOLID) != 0;
+}
+
+AABB level_aabb = {0}; // set when the level's loaded
+Entity entities[MAX_ENTITIES] = {0};
+
+// component tables, packed so per kind loops only walk the entities of that kind
+BUFF(OldMan, MAX_ENTITIES) old_men = {0};
+BUFF(Character, MAX_ENTITIES) characters = {0};
+
+// swap removes to keep the table packed, then points the entity of the component
+// that was moved at its new index
+#define COMPONENT_REMOVE(buff_ptr, index) { int last = --(buff_ptr)->cur_index; (buff_ptr)->data[(index)] = (buff_ptr)->data[last]; if((int)(index) != last) entities[(buff_ptr)->data[(index)].entity].component = (index); }
+
+OldMan *old_man(Entity *e)
+{
+ assert(e->kind == ENTITY_OLD_MAN);
+ return &old_men.data[e->component];
+}
+
+Character *character(Entity *e)
+{
+ assert(e->kind == ENTITY_PLAYER);
+ return &characters.data[e->component];
+}
+
+// for referring to an entity across frames. Slots are reused, so a pointer can end up
+// pointing at some new entity after the one it was for is destroyed. The generation of a
+// slot goes up every time that happens, so a handle to a destroyed entity is detected.
+// Zero initialized is a null handle, generations start at 1
+typedef struct EntityHandle
+{
+ uint32_t index;
+ uint32_t generation;
+} EntityHandle;
+
+uint32_t entity_generations[MAX_ENTITIES] = {0};
+uint32_t free_entities[MAX_ENTITIES] = {0}; // stack of indices of slots that don't exist
+uint32_t num_free_entities = 0;
+
+// indices of every entity that exists, packed, so per frame work scales with how many
+// there are instead of MAX_ENTITIES. alive_index is where each one is in the list
+uint32_t alive_entities[MAX_ENTITIES] = {0};
+uint32_t alive_index[MAX_ENTITIES] = {0};
+uint32_t num_alive_entities = 0;
+
+// walks the live entities. Backwards, so destroying `it` only moves an entity that's
+// already been visited into its place. `continue` works, `break` doesn't
+#define ALIVE_ENTITIES_ITER for(uint32_t alive_i = num_alive_entities; alive_i-- > 0;) for(Entity *it = &entities[alive_entities[alive_i]]; it != NULL; it = NULL)
+
+EntityHandle player_handle = {0};
+
+EntityHandle entity_handle(Entity *e)
+{
+ uint32_t index = (uint32_t)(e - entities);
+ return (EntityHandle){ .index = index, .generation = entity_generations[index] };
+}
+
+// NULL if the entity has been destroyed
+Entity *get_entity(EntityHandle handle)
+{
+ if(handle.generation == 0 || handle.index >= MAX_ENTITIES) return NULL;
+ if(entity_generations[handle.index] != handle.generation) return NULL;
+ return &entities[handle.index];
+}
+
+// broadphase. Entities are bucketed by the tile their center is in, and queries
+// only walk the buckets of the tiles they cover. Kept up to date incrementally
+// with spatial_hash_update whenever an entity moves, spawns or is destroyed
+#define SPATIAL_HASH_BUCKETS 1024 // must be a power of two
+typedef struct SpatialHash
+{
+ int first[SPATIAL_HASH_BUCKETS]; // entity index, -1 if the bucket is empty
+ int next[MAX_ENTITIES];
+ int prev[MAX_ENTITIES];
+ int bucket[MAX_ENTITIES]; // -1 if the entity isn't in the hash
+ TileCoord cell[MAX_ENTITIES];
+} SpatialHash;
+
+SpatialHash spatial_hash = {0};
+
+// packed copy of every entity's bounds, indexed like entities[], so overlap tests
+// can run on many entities at once without touching the entities or entity_aabb_size.
+// Kept in sync by spatial_hash_update. Y+ is up so max_y is the top. Empty slots
+// are inside out and never overlap anything
+typedef struct EntityBounds
+{
+ float min_x[MAX_ENTITIES];
+ float min_y[MAX_ENTITIES];
+ float max_x[MAX_ENTITIES];
+ float max_y[MAX_ENTITIES];
+} EntityBounds;
+
+EntityBounds entity_bounds = {0};
+
+// tests the aabb against `count` packed boxes, setting bit i of hit_mask if box i
+// overlaps it. Same as overlapping(), touching doesn't count. hit_mask needs
+// (count + 63)/64 words
+void overlap_mask(const float *min_x, const float *min_y, const float *max_x, const float *max_y, int count, AABB aabb, uint64_t *hit_mask)
+{
+ float q_min_x = aabb.upper_left.X;
+ float q_max_x = aabb.lower_right.X;
+ float q_min_y = aabb.lower_right.Y;
+ float q_max_y = aabb.upper_left.Y;
+ for(int word = 0; word < (count + 63)/64; word++) hit_mask[word] = 0;
+
+ // lanes are a power of two starting from 0, so never straddle a mask word
+ int i = 0;
+#if defined(__AVX2__)
+ {
+  __m256 min_x_q = _mm256_set1_ps(q_min_x);
+  __m256 max_x_q = _mm256_set1_ps(q_max_x);
+  __m256 min_y_q = _mm256_set1_ps(q_min_y);
+  __m256 max_y_q = _mm256_set1_ps(q_max_y);
+  for(; i + 8 <= count; i += 8)
+  {
+   __m256 x = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(min_x + i), max_x_q, _CMP_LT_OQ), _mm256_cmp_ps(min_x_q, _mm256_loadu_ps(max_x + i), _CMP_LT_OQ));
+   __m256 y = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(min_y + i), max_y_q, _CMP_LT_OQ), _mm256_cmp_ps(min_y_q, _mm256_loadu_ps(max_y + i), _CMP_LT_OQ));
+   hit_mask[i/64] |= (uint64_t)_mm256_movemask_ps(_mm256_and_ps(x, y)) << (i % 64);
+  }
+ }
+#elif defined(USE_SSE2)
+ {
+  __m128 min_x_q = _mm_set1_ps(q_min_x);
+  __m128 max_x_q = _mm_set1_ps(q_max_x);
+  __m128 min_y_q = _mm_set1_ps(q_min_y);
+  __m128 max_y_q = _mm_set1_ps(q_max_y);
+  for(; i + 4 <= count; i += 4)
+  {
+   __m128 x = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(min_x + i), max_x_q), _mm_cmplt_ps(min_x_q, _mm_loadu_ps(max_x + i)));
+   __m128 y = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(min_y + i), max_y_q), _mm_cmplt_ps(min_y_q, _mm_loadu_ps(max_y + i)));
+   hit_mask[i/64] |= (uint64_t)_mm_movemask_ps(_mm_and_ps(x, y)) << (i % 64);
+  }
+ }
+#elif defined(__wasm_simd128__)
+ {
+  v128_t min_x_q = wasm_f32x4_splat(q_min_x);
+  v128_t max_x_q = wasm_f32x4_splat(q_max_x);
+  v128_t min_y_q = wasm_f32x4_splat(q_min_y);
+  v128_t max_y_q = wasm_f32x4_splat(q_max_y);
+  for(; i + 4 <= count; i += 4)
+  {
+   v128_t x = wasm_v128_and(wasm_f32x4_lt(wasm_v128_load(min_x + i), max_x_q), wasm_f32x4_lt(min_x_q, wasm_v128_load(max_x + i)));
+   v128_t y = wasm_v128_and(wasm_f32x4_lt(wasm_v128_load(min_y + i), max_y_q), wasm_f32x4_lt(min_y_q, wasm_v128_load(max_y + i)));
+   hit_mask[i/64] |= (uint64_t)wasm_i32x4_bitmask(wasm_v128_and(x, y)) << (i % 64);
+  }
+ }
+#endif
+ for(; i < count; i++)
+ {
+  bool hit = min_x[i] < q_max_x && q_min_x < max_x[i] && min_y[i] < q_max_y && q_min_y < max_y[i];
+  hit_mask[i/64] |= (uint64_t)hit << (i % 64);
+ }
+}
+
+int spatial_hash_bucket(TileCoord cell)
+{
+ uint32_t hash = ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u);
+ return (int)(hash & (SPATIAL_HASH_BUCKETS - 1));
+}
+
+void spatial_hash_remove(Entity *e)
+{
+ SpatialHash *h = &spatial_hash;
+ int index = (int)(e - entities);
+ int bucket = h->bucket[index];
+ if(bucket == -1) return;
+ if(h->prev[index] != -1) h->next[h->prev[index]] = h->next[index];
+ else h->first[bucket] = h->next[index];
+ if(h->next[index] != -1) h->prev[h->next[index]] = h->prev[index];
+ h->bucket[index] = -1;
+}
+
+// call after changing an entity's position or existence
+void spatial_hash_update(Entity *e)
+{
+ SpatialHash *h = &spatial_hash;
+ int index = (int)(e - entities);
+ if(!e->exists)
+ {
+  entity_bounds.min_x[index] = INFINITY;
+  entity_bounds.min_y[index] = INFINITY;
+  entity_bounds.max_x[index] = -INFINITY;
+  entity_bounds.max_y[index] = -INFINITY;
+  spatial_hash_remove(e);
+  return;
+ }
+ AABB aabb = entity_aabb(e);
+ entity_bounds.min_x[index] = aabb.upper_left.X;
+ entity_bounds.min_y[index] = aabb.lower_right.Y;
+ entity_bounds.max_x[index] = aabb.lower_right.X;
+ entity_bounds.max_y[index] = aabb.upper_left.Y;
+
+ TileCoord cell = world_to_tilecoord(e->pos);
+ if(h->bucket[index] != -1 && h->cell[index].x == cell.x && h->cell[index].y == cell.y) return;
+ spatial_hash_remove(e);
+
+ int bucket = spatial_hash_bucket(cell);
+ h->cell[index] = cell;
+ h->bucket[index] = bucket;
+ h->prev[index] = -1;
+ h->next[index] = h->first[bucket];
+ if(h->first[bucket] != -1) h->prev[h->first[bucket]] = index;
+ h->first[bucket] = index;
+}
+
+void rebuild_spatial_hash()
+{
+ SpatialHash *h = &spatial_hash;
+ for(int i = 0; i < ARRLEN(h->first); i++) h->first[i] = -1;
+ for(int i = 0; i < ARRLEN(h->bucket); i++) h->bucket[i] = -1;
+ for(int i = 0; i < ARRLEN(entities); i++) spatial_hash_update(&entities[i]);
+}
+
+// entities overlapping the aabb, allocated from the scratch arena. Gathers the bounds
+// of everything in the hash buckets the aabb covers and tests them together with
+// overlap_mask, or for big queries the bounds of every live entity
+EntitySpan overlapping_entities(AABB aabb)
+{
+ SpatialHash *h = &spatial_hash;
+ const float margin = LARGEST_ENTITY_SIZE*0.5f;
+ TileCoord from = world_to_tilecoord(AddV2(aabb.upper_left, V2(-margin, margin)));
+ TileCoord to = world_to_tilecoord(AddV2(aabb.lower_right, V2(margin, -margin)));
+ EntitySpan to_return = {0};
+
+ int num_tested = 0;
+ uint32_t *candidates = NULL; // index into entities of each tested box
+ int64_t num_cells = (int64_t)(to.x - from.x + 1) * (int64_t)(to.y - from.y + 1);
+ if(num_cells >= (int64_t)num_alive_entities)
+ {
+  // walking the cells would take longer than testing everything
+  candidates = alive_entities;
+  num_tested = (int)num_alive_entities;
+ }
+ else
+ {
+  // once to count them, then again to write them
+  for(int pass = 0; pass < 2; pass++)
+  {
+   if(pass == 1) candidates = ARENA_PUSH(&scratch, uint32_t, num_tested);
+   num_tested = 0;
+   for(int y = from.y; y <= to.y; y++)
+   {
+    for(int x = from.x; x <= to.x; x++)
+    {
+     for(int i = h->first[spatial_hash_bucket((TileCoord){x, y})]; i != -1; i = h->next[i])
+     {
+      // buckets are shared between cells, so only take the entities actually in this one.
+      // Each entity lives in exactly one cell so there are no duplicates
+      if(h->cell[i].x != x || h->cell[i].y != y) continue;
+      if(pass == 1) candidates[num_tested] = (uint32_t)i;
+      num_tested++;
+     }
+    }
+   }
+  }
+ }
+
+ float *gathered = ARENA_PUSH(&scratch, float, num_tested*4);
+ float *min_x = gathered;
+ float *min_y = gathered + num_tested;
+ float *max_x = gathered + num_tested*2;
+ float *max_y = gathered + num_tested*3;
+ for(int i = 0; i < num_tested; i++)
+ {
+  min_x[i] = entity_bounds.min_x[candidates[i]];
+  min_y[i] = entity_bounds.min_y[candidates[i]];
+  max_x[i] = entity_bounds.max_x[candidates[i]];
+  max_y[i] = entity_bounds.max_y[candidates[i]];
+ }
+ uint64_t *hit_mask = ARENA_PUSH(&scratch, uint64_t, (num_tested + 63)/64);
+ overlap_mask(min_x, min_y, max_x, max_y, num_tested, aabb, hit_mask);
+
+ for(int word = 0; word < (num_tested + 63)/64; word++) to_return.count += count_set_bits(hit_mask[word]);
+ to_return.data = ARENA_PUSH(&scratch, Entity *, to_return.count);
+ int num_out = 0;
+ for(int word = 0; word < (num_tested + 63)/64; word++)
+ {
+  for(uint64_t bits = hit_mask[word]; bits != 0; bits &= bits - 1)
+  {
+   int tested_index = word*64 + lowest_set_bit(bits);
+   to_return.data[num_out++] = &entities[candidates[tested_index]];
+  }
+ }
+ return to_return;
+}
+
+// empties every slot, handles to anything from before are no longer valid
+void clear_entities()
+{
+ for(uint32_t i = 0; i < MAX_ENTITIES; i++)
+ {
+  if(entities[i].exists) entity_generations[i] += 1;
+  if(entity_generations[i] == 0) entity_generations[i] = 1;
+  entities[i] = (Entity){0};
+ }
+ old_men.cur_index = 0;
+ characters.cur_index = 0;
+ // reversed so slots are handed out from the start of the array
+ num_free_entities = 0;
+ for(uint32_t i = MAX_ENTITIES; i > 0; i--)
+ {
+  free_entities[num_free_entities++] = i - 1;
+ }
+ num_alive_entities = 0;
+ rebuild_spatial_hash();
+}
+
+Entity *new_entity(EntityKind kind)
+{
+ assert(num_free_entities > 0);
+ uint32_t index = free_entities[--num_free_entities];
+ Entity *to_return = &entities[index];
+ *to_return = (Entity){ .exists = true, .kind = kind };
+ alive_index[index] = num_alive_entities;
+ alive_entities[num_alive_entities++] = index;
+ if(kind == ENTITY_OLD_MAN)
+ {
+  to_return->component = (uint32_t)old_men.cur_index;
+  BUFF_APPEND(&old_men, ((OldMan){ .entity = index }));
+ }
+ else if(kind == ENTITY_PLAYER)
+ {
+  to_return->component = (uint32_t)characters.cur_index;
+  BUFF_APPEND(&characters, ((Character){ .entity = index }));
+ }
+ return to_return;
+}
+
+// use this instead of zeroing the entity so it's taken out of the broadphase, and its
+// slot can be reused
+void destroy_entity(Entity *e)
+{
+ assert(e->exists);
+ uint32_t index = (uint32_t)(e - entities);
+ spatial_hash_remove(e);
+ if(e->kind == ENTITY_OLD_MAN) COMPONENT_REMOVE(&old_men, e->component)
+ else if(e->kind == ENTITY_PLAYER) COMPONENT_REMOVE(&characters, e->component)
+ *e = (Entity){0};
+ uint32_t last = alive_entities[--num_alive_entities];
+ alive_entities[alive_index[index]] = last;
+ alive_index[last] = alive_index[index];
+ entity_generations[index] += 1;
+ if(entity_generations[index] == 0) entity_generations[index] = 1; // wrapped around
+ free_entities[num_free_entities++] = index;
+}
+
+// bullets aren't entities, there are too many of them. They're packed one array per
+// field here and are moved, collided and drawn all at once
+#define MAX_PROJECTILES (1024*16)
+#define PROJECTILE_SIZE (TILE_SIZE*0.25f)
+typedef struct Projectiles
+{
+ float pos_x[MAX_PROJECTILES];
+ float pos_y[MAX_PROJECTILES];
+ float prev_x[MAX_PROJECTILES]; // before the last tick, like Entity.prev_pos
+ float prev_y[MAX_PROJECTILES];
+ float vel_x[MAX_PROJECTILES]; // meters per second, like Entity.vel
+ float vel_y[MAX_PROJECTILES];
+ int count;
+} Projectiles;
+
+Projectiles projectiles = {0};
+
+void spawn_projectile(Vec2 pos, Vec2 vel)
+{
+ assert(projectiles.count < MAX_PROJECTILES);
+ int index = projectiles.count++;
+ projectiles.pos_x[index] = pos.X;
+ projectiles.pos_y[index] = pos.Y;
+ projectiles.prev_x[index] = pos.X;
+ projectiles.prev_y[index] = pos.Y;
+ projectiles.vel_x[index] = vel.X;
+ projectiles.vel_y[index] = vel.Y;
+}
+
+// changes to what exists, and to other entities, are pushed here while updating and
+// applied all at once by apply_commands. So an update pass never changes what it's
+// iterating over, and only writes to the thing it's updating, which makes the
+// order things are updated in not matter
+typedef enum CommandKind
+{
+ COMMAND_SPAWN_ENTITY,
+ COMMAND_DESTROY_ENTITY,
+ COMMAND_SPAWN_PROJECTILE,
+ COMMAND_HIT, // damage and knockback
+ COMMAND_PROVOKE, // makes old men aggressive
+} CommandKind;
+
+typedef struct Command
+{
+ CommandKind kind;
+ EntityHandle entity; // destroyed or hit
+ EntityKind entity_kind; // spawned
+ Vec2 pos; // where it's spawned, or where the hit came from
+ Vec2 vel;
+ float damage;
+} Command;
+
+BUFF(Command, MAX_PROJECTILES*2) commands = {0}; // every projectile can hit something in the same frame
+
+void push_command(Command command)
+{
+ BUFF_APPEND(&commands, command);
+}
+
+// the sync point, in the order they were pushed
+void apply_commands()
+{
+ BUFF_ITER(Command, &commands)
+ {
+  if(it->kind == COMMAND_SPAWN_ENTITY)
+  {
+   Entity *spawned = new_entity(it->entity_kind);
+   spawned->pos = it->pos;
+   spawned->prev_pos = it->pos;
+   spawned->vel = it->vel;
+   spatial_hash_update(spawned);
+  }
+  else if(it->kind == COMMAND_SPAWN_PROJECTILE)
+  {
+   spawn_projectile(it->pos, it->vel);
+  }
+  else
+  {
+   // could've been destroyed by an earlier command
+   Entity *e = get_entity(it->entity);
+   if(e == NULL) continue;
+   if(it->kind == COMMAND_DESTROY_ENTITY)
+   {
+    destroy_entity(e);
+   }
+   else if(it->kind == COMMAND_PROVOKE)
+   {
+    if(e->kind == ENTITY_OLD_MAN) old_man(e)->aggressive = true;
+   }
+   else if(it->kind == COMMAND_HIT)
+   {
+    if(e->kind == ENTITY_OLD_MAN) old_man(e)->aggressive = true;
+    e->vel = MulV2F(NormV2(SubV2(e->pos, it->pos)), 5.0f);
+    e->damage += it->damage;
+   }
+   else
+   {
+    assert(false);
+   }
+  }
+ }
+ commands.cur_index = 0;
+}
+
+// whether everything the game reads from the file is inside it, so a broken file can't
+// make it read or write out of bounds later. Checked once, the chunks are decoded
+// without checking again
+bool level_file_ok(const uint8_t *file, size_t size)
+{
+ const LevelFileHeader *header = (const LevelFileHeader *)file;
+ if(size < sizeof(*header) || header->magic != LEVEL_FILE_MAGIC || header->version != LEVEL_FILE_VERSION || header->size != size) return false;
+ if(header->chunk_tiles != CHUNK_TILES || header->width <= 0 || header->height <= 0 || header->num_entities > MAX_LEVEL_ENTITIES) return false;
+
+ uint64_t entities_end = (uint64_t)header->entities_offset + (uint64_t)header->num_entities*sizeof(LevelFileEntity);
+ if(header->entities_offset % sizeof(uint32_t) != 0 || entities_end > size) return false;
+ const LevelFileEntity *placed = (const LevelFileEntity *)(file + header->entities_offset);
+ for(uint32_t i = 0; i < header->num_entities; i++)
+ {
+  if(placed[i].kind == ENTITY_INVALID || placed[i].kind >= ENTITY_LAST) return false;
+  // inside the level, which is below and to the right of the origin. Also false for nans
+  if(!(placed[i].x >= 0.0f && placed[i].x <= (float)header->width*TILE_SIZE && placed[i].y <= 0.0f && placed[i].y >= -(float)header->height*TILE_SIZE)) return false;
+ }
+
+ uint64_t solid_end = (uint64_t)header->solid_offset + (uint64_t)SOLID_WORDS_PER_ROW((uint64_t)header->width)*header->height*sizeof(uint64_t);
+ if(header->solid_offset % sizeof(uint64_t) != 0 || solid_end > size) return false;
+
+ uint64_t num_chunks = (uint64_t)((header->width + CHUNK_TILES - 1)/CHUNK_TILES)*((header->height + CHUNK_TILES - 1)/CHUNK_TILES);
+ uint64_t chunks_end = (uint64_t)header->chunks_offset + (num_chunks + 1)*sizeof(uint32_t);
+ if(header->chunks_offset % sizeof(uint32_t) != 0 || chunks_end > size) return false;
+ const uint32_t *chunk_offsets = (const uint32_t *)(file + header->chunks_offset);
+ for(uint64_t i = 0; i < num_chunks; i++)
+ {
+  uint32_t from = chunk_offsets[i];
+  uint32_t to = chunk_offsets[i + 1];
+  if(from > to || to > size || from % sizeof(LevelFileRun) != 0 || (to - from) % sizeof(LevelFileRun) != 0) return false;
+  uint32_t num_tiles = 0;
+  for(const LevelFileRun *run = (const LevelFileRun *)(file + from); run < (const LevelFileRun *)(file + to); run++)
+  {
+   num_tiles += run->count;
+   if(num_tiles > CHUNK_TILES*CHUNK_TILES) return false;
+  }
+  if(num_tiles != CHUNK_TILES*CHUNK_TILES) return false;
+ }
+ return true;
+}
+
+// reads the level's file, which has to have been baked by the codegen this was built with
+void load_level(Level *l)
+{
+ FILE *file = fopen(l->filepath, "rb");
+ if(file == NULL)
+ {
+  fprintf(stderr, "Couldn't open %s, run codegen to bake it\n", l->filepath);
+  exit(1);
+ }
+ fseek(file, 0, SEEK_END);
+ size_t size = (size_t)ftell(file);
+ fseek(file, 0, SEEK_SET);
+ l->file = malloc(size); // aligned enough for the solidity, which is at a multiple of 8 in the file
+ size_t read = fread(l->file, 1, size, file);
+ fclose(file);
+
+ if(read != size || !level_file_ok(l->file, size))
+ {
+  fprintf(stderr, "%s is from a different version of the game or broken, run codegen to bake it again\n", l->filepath);
+  exit(1);
+ }
+ LevelFileHeader *header = (LevelFileHeader *)l->file;
+
+ l->width = header->width;
+ l->height = header->height;
+ l->solid = (const uint64_t *)(l->file + header->solid_offset);
+ l->chunk_offsets = (const uint32_t *)(l->file + header->chunks_offset);
+ const LevelFileEntity *placed = (const LevelFileEntity *)(l->file + header->entities_offset);
+ for(uint32_t i = 0; i < header->num_entities; i++)
+ {
+  l->initial_entities[i] = (Entity){ .exists = true, .kind = (EntityKind)placed[i].kind, .pos = V2(placed[i].x, placed[i].y) };
+ }
+}
+
+void reset_level()
+{
+ // load level
+ Level *to_load = &level_level0;
+ if(to_load->file == NULL) load_level(to_load);
+ {
+  clear_entities();
+  projectiles.count = 0;
+  commands.cur_index = 0;
+
+  level_aabb = (AABB){ .upper_left = { 0.0f, 0.0f }, .lower_right = { (float)(to_load->width*TILE_SIZE), -(float)(to_load->height*TILE_SIZE) } };
+
+  player_handle = (EntityHandle){0};
+  ENTITIES_ITER(to_load->initial_entities)
+  {
+   Entity *spawned = new_entity(it->kind);
+   spawned->pos = it->pos;
+   spawned->prev_pos = it->pos;
+   spatial_hash_update(spawned);
+   if(spawned->kind == ENTITY_PLAYER)
+   {
+    assert(get_entity(player_handle) == NULL);
+    player_handle = entity_handle(spawned);
+   }
+  }
+  assert(get_entity(player_handle) != NULL); // level initial config must have player entity
+ }
+}
+
+typedef struct Input
+{
+ Vec2 movement; // length at most 1
+ bool attack;
+ bool roll;
+} Input;
+
+// the keys held down that make up an Input, one bit each. This is what's recorded
+// per tick, so a recording replays exactly
+typedef uint8_t InputKeys;
+#define INPUT_RIGHT  (1 << 0)
+#define INPUT_LEFT   (1 << 1)
+#define INPUT_UP     (1 << 2)
+#define INPUT_DOWN   (1 << 3)
+#define INPUT_ATTACK (1 << 4)
+#define INPUT_ROLL   (1 << 5)
+
+Input input_from_keys(InputKeys keys)
+{
+ Vec2 movement = V2(
+  (float)((keys & INPUT_RIGHT) != 0) - (float)((keys & INPUT_LEFT) != 0),
+  (float)((keys & INPUT_UP) != 0) - (float)((keys & INPUT_DOWN) != 0)
+ );
+ if(LenV2(movement) > 1.0)
+ {
+  movement = NormV2(movement);
+ }
+ return (Input){ .movement = movement, .attack = (keys & INPUT_ATTACK) != 0, .roll = (keys & INPUT_ROLL) != 0 };
+}
+
+// everything is in pixels in world space, 43 pixels is approx 1 meter measured from 
+// merchant sprite being 5'6"
+const float pixels_per_meter = 43.0f;
+
+// both segment_a and segment_b must be arrays of length 2
+bool segments_overlapping(float *a_segment, float *b_segment)
+{
+ assert(a_segment[1] >= a_segment[0]);
+ assert(b_segment[1] >= b_segment[0]);
+ float total_length = (a_segment[1] - a_segment[0]) + (b_segment[1] - b_segment[0]);
+ float farthest_to_left = fminf(a_segment[0], b_segment[0]);
+ float farthest_to_right = fmaxf(a_segment[1], b_segment[1]);
+ if (farthest_to_right - farthest_to_left < total_length)
+ {
+  return true;
+ } else
+ {
+  return false;
+ }
+}
+
+bool overlapping(AABB a, AABB b)
+{
+ // x axis
+
+ {
+  float a_segment[2] =
+  { a.upper_left.X, a.lower_right.X };
+  float b_segment[2] =
+  { b.upper_left.X, b.lower_right.X };
+  if(segments_overlapping(a_segment, b_segment))
+  {
+  } else
+  {
+   return false;
+  }
+ }
+
+ // y axis
+
+ {
+  float a_segment[2] =
+  { a.lower_right.Y, a.upper_left.Y };
+  float b_segment[2] =
+  { b.lower_right.Y, b.upper_left.Y };
+  if(segments_overlapping(a_segment, b_segment))
+  {
+  } else
+  {
+   return false;
+  }
+ }
+
+ return true; // both segments overlapping
+}
+
+// smallest translation which moves `a` out of `b`, along a single axis. Zero if
+// they aren't overlapping. Exactly touching afterwards, which doesn't count as overlapping
+Vec2 minimum_translation(AABB a, AABB b)
+{
+ float overlap_x = fminf(a.lower_right.X, b.lower_right.X) - fmaxf(a.upper_left.X, b.upper_left.X);
+ float overlap_y = fminf(a.upper_left.Y, b.upper_left.Y) - fmaxf(a.lower_right.Y, b.lower_right.Y);
+ if(overlap_x <= 0.0f || overlap_y <= 0.0f) return V2(0.0f, 0.0f);
+
+ Vec2 from_b = SubV2(aabb_center(a), aabb_center(b));
+ if(overlap_x < overlap_y)
+ {
+  return V2(from_b.X >= 0.0f ? overlap_x : -overlap_x, 0.0f);
+ }
+ else
+ {
+  return V2(0.0f, from_b.Y >= 0.0f ? overlap_y : -overlap_y);
+ }
+}
+
+// when `moving` travelling by `movement` first hits the stationary `target`, as a fraction
+// of the movement in [0, 1]. Already overlapping is a hit at 0. Found with the slab method
+// so nothing is skipped no matter how far it moves
+bool swept_aabb(AABB moving, Vec2 movement, AABB target, float *time_of_impact)
+{
+ float entry_x, exit_x, entry_y, exit_y;
+ if(movement.X > 0.0f)
+ {
+  entry_x = (target.upper_left.X - moving.lower_right.X) / movement.X;
+  exit_x  = (target.lower_right.X - moving.upper_left.X) / movement.X;
+ }
+ else if(movement.X < 0.0f)
+ {
+  entry_x = (target.lower_right.X - moving.upper_left.X) / movement.X;
+  exit_x  = (target.upper_left.X - moving.lower_right.X) / movement.X;
+ }
+ else
+ {
+  if(moving.lower_right.X <= target.upper_left.X || target.lower_right.X <= moving.upper_left.X) return false;
+  entry_x = -INFINITY;
+  exit_x = INFINITY;
+ }
+
+ // Y+ is up, so the top of a box is upper_left.Y
+ if(movement.Y > 0.0f)
+ {
+  entry_y = (target.lower_right.Y - moving.upper_left.Y) / movement.Y;
+  exit_y  = (target.upper_left.Y - moving.lower_right.Y) / movement.Y;
+ }
+ else if(movement.Y < 0.0f)
+ {
+  entry_y = (target.upper_left.Y - moving.lower_right.Y) / movement.Y;
+  exit_y  = (target.lower_right.Y - moving.upper_left.Y) / movement.Y;
+ }
+ else
+ {
+  if(moving.upper_left.Y <= target.lower_right.Y || target.upper_left.Y <= moving.lower_right.Y) return false;
+  entry_y = -INFINITY;
+  exit_y = INFINITY;
+ }
+
+ float entry = fmaxf(entry_x, entry_y);
+ float exit = fminf(exit_x, exit_y);
+ if(entry >= exit || exit <= 0.0f || entry > 1.0f) return false;
+ *time_of_impact = fmaxf(entry, 0.0f);
+ return true;
+}
+
+AABB aabb_union(AABB a, AABB b)
+{
+ return (AABB){
+  .upper_left = V2(fminf(a.upper_left.X, b.upper_left.X), fmaxf(a.upper_left.Y, b.upper_left.Y)),
+  .lower_right = V2(fmaxf(a.lower_right.X, b.lower_right.X), fminf(a.lower_right.Y, b.lower_right.Y)),
+ };
+}
+
+AABB moved_aabb(AABB aabb, Vec2 by)
+{
+ return (AABB){ .upper_left = AddV2(aabb.upper_left, by), .lower_right = AddV2(aabb.lower_right, by) };
+}
+
+bool has_point(AABB aabb, Vec2 point)
+{
+ return
+  (aabb.upper_left.X < point.X && point.X < aabb.lower_right.X) &&
+  (aabb.upper_left.Y > point.Y && point.Y > aabb.lower_right.Y);
+}
+
+double anim_sprite_duration(AnimatedSprite *s)
+{
+ return s->num_frames * s->time_per_frame;
+}
+
+typedef bool (*EntityPredicate)(Entity *e);
+
+#define KIND_BIT(kind) (1u << (kind))
+
+// zero initialized means no filtering
+typedef struct OverlapFilter
+{
+ bool no_tiles;
+ uint32_t kinds; // KIND_BITs of entity kinds to include, 0 for every kind
+ Entity *exclude;
+ EntityPredicate predicate; // entities it returns false for are left out
+} OverlapFilter;
+
+// gets aabbs overlapping the input aabb, including entities and tiles. Allocated from
+// the scratch arena, so only valid for this frame. No duplicates
+Overlapping get_overlapping(Level *l, AABB aabb, OverlapFilter filter)
+{
+ TileCoordSpan tiles = {0};
+ if(!filter.no_tiles) tiles = solid_tiles_in_aabb(l, aabb);
+ EntitySpan entities_overlapping = overlapping_entities(aabb);
+
+ Overlapping to_return = { .data = ARENA_PUSH(&scratch, Overlap, tiles.count + entities_overlapping.count) };
+
+ // the tiles, jessie
+ SPAN_ITER(TileCoord, &tiles)
+ {
+  to_return.data[to_return.count++] = (Overlap){.is_tile = true, .tile = *it};
+ }
+
+ // the entities jessie
+ SPAN_ITER(Entity *, &entities_overlapping)
+ {
+  Entity *e = *it;
+  if(e->intangible) continue;
+  if(filter.kinds != 0 && !(filter.kinds & KIND_BIT(e->kind))) continue;
+  if(e == filter.exclude) continue;
+  if(filter.predicate && !filter.predicate(e)) continue;
+  to_return.data[to_return.count++] = (Overlap){.e = e};
+ }
+
+ return to_return;
+}
+
+// first solid tile hit by a box moving by `movement`. Walks the tiles along the path
+// of the box's center in order (grid DDA), checking the tiles the box sweeps over
+// while its center is in each one, so long moves stop at the first cell with a hit
+bool sweep_tiles(Level *l, AABB box, Vec2 movement, float *time_of_impact, TileCoord *hit_tile)
+{
+ Vec2 start = aabb_center(box);
+ TileCoord cell = world_to_tilecoord(start);
+
+ // tile y goes down as world y goes up
+ int step_x = movement.X > 0.0f ? 1 : -1;
+ int step_y = movement.Y > 0.0f ? -1 : 1;
+ float next_x = INFINITY, next_y = INFINITY; // time the center crosses into the next column/row
+ float delta_x = INFINITY, delta_y = INFINITY;
+ if(movement.X != 0.0f)
+ {
+  float boundary = (float)(movement.X > 0.0f ? cell.x + 1 : cell.x) * TILE_SIZE;
+  next_x = (boundary - start.X) / movement.X;
+  delta_x = TILE_SIZE / fabsf(movement.X);
+ }
+ if(movement.Y != 0.0f)
+ {
+  float boundary = -(float)(movement.Y > 0.0f ? cell.y : cell.y + 1) * TILE_SIZE;
+  next_y = (boundary - start.Y) / movement.Y;
+  delta_y = TILE_SIZE / fabsf(movement.Y);
+ }
+
+ float segment_start = 0.0f;
+ while(segment_start <= 1.0f)
+ {
+  float segment_end = fminf(fminf(next_x, next_y), 1.0f);
+  AABB swept = aabb_union(moved_aabb(box, MulV2F(movement, segment_start)), moved_aabb(box, MulV2F(movement, segment_end)));
+
+  TileCoordSpan solid_tiles = solid_tiles_in_aabb(l, swept);
+  bool hit = false;
+  SPAN_ITER(TileCoord, &solid_tiles)
+  {
+   float toi;
+   if(swept_aabb(box, movement, tile_aabb(*it), &toi) && (!hit || toi < *time_of_impact))
+   {
+    hit = true;
+    *time_of_impact = toi;
+    *hit_tile = *it;
+   }
+  }
+  // anything hit before this segment ends has to be in this segment's tiles
+  if(hit) return true;
+
+  if(segment_end >= 1.0f) break;
+  if(next_x < next_y)
+  {
+   cell.x += step_x;
+   segment_start = next_x;
+   next_x += delta_x;
+  }
+  else
+  {
+   cell.y += step_y;
+   segment_start = next_y;
+   next_y += delta_y;
+  }
+ }
+ return false;
+}
+
+// returns the position pushed out of every collidable thing the entity would overlap there.
+// After moving, this is what makes it slide along walls
+Vec2 depenetrate(Entity *from, Vec2 position)
+{
+ Vec2 collision_aabb_size = entity_aabb_size(from);
+ AABB at_new = centered_aabb(position, collision_aabb_size);
+ sim_dbgrect(at_new);
+ TileCoordSpan solid_tiles = solid_tiles_in_aabb(&level_level0, at_new);
+ EntitySpan overlapping_at_new = {0};
+ if(!from->intangible) overlapping_at_new = overlapping_entities(at_new);
+
+ AABB *to_check = ARENA_PUSH(&scratch, AABB, solid_tiles.count + overlapping_at_new.count);
+ int to_check_index = 0;
+
+ // add tilemap boxes
+ SPAN_ITER(TileCoord, &solid_tiles)
+ {
+  to_check[to_check_index++] = tile_aabb(*it);
+ }
+
+ // add entity boxes
+ SPAN_ITER(Entity *, &overlapping_at_new)
+ {
+  Entity *e = *it;
+  if(!e->intangible && e != from)
+  {
+   to_check[to_check_index++] = entity_aabb(e);
+  }
+ }
+
+ for(int i = 0; i < to_check_index; i++)
+ {
+  AABB to_depenetrate_from = to_check[i];
+  sim_dbgrect(to_depenetrate_from);
+  Vec2 push = minimum_translation(at_new, to_depenetrate_from);
+  at_new.upper_left = AddV2(at_new.upper_left, push);
+  at_new.lower_right = AddV2(at_new.lower_right, push);
+ }
+
+ return aabb_center(at_new);
+}
+
+AABB projectile_aabb(int index)
+{
+ return centered_aabb(V2(projectiles.pos_x[index], projectiles.pos_y[index]), V2(PROJECTILE_SIZE, PROJECTILE_SIZE));
+}
+
+// how far each projectile moves this frame, and the box it sweeps over doing so.
+// In the scratch arena, indexed like the projectiles
+typedef struct ProjectileMotion
+{
+ int count;
+ float *move_x;
+ float *move_y;
+ float *min_x;
+ float *min_y;
+ float *max_x;
+ float *max_y;
+} ProjectileMotion;
+
+#define PROJECTILE_BATCH (64*16) // a multiple of 64, so each batch has whole words of hit masks
+
+typedef struct IntegrateProjectiles
+{
+ ProjectileMotion motion;
+ float dt;
+} IntegrateProjectiles;
+
+void integrate_projectiles_job(void *data, int from, int to)
+{
+ IntegrateProjectiles *job = data;
+ float dt = job->dt;
+ float *move_x = job->motion.move_x;
+ float *move_y = job->motion.move_y;
+ float *min_x = job->motion.min_x;
+ float *min_y = job->motion.min_y;
+ float *max_x = job->motion.max_x;
+ float *max_y = job->motion.max_y;
+ const float half_size = PROJECTILE_SIZE*0.5f;
+ for(int i = from; i < to; i++)
+ {
+  move_x[i] = projectiles.vel_x[i] * pixels_per_meter * dt;
+  move_y[i] = projectiles.vel_y[i] * pixels_per_meter * dt;
+  min_x[i] = fminf(projectiles.pos_x[i], projectiles.pos_x[i] + move_x[i]) - half_size;
+  min_y[i] = fminf(projectiles.pos_y[i], projectiles.pos_y[i] + move_y[i]) - half_size;
+  max_x[i] = fmaxf(projectiles.pos_x[i], projectiles.pos_x[i] + move_x[i]) + half_size;
+  max_y[i] = fmaxf(projectiles.pos_y[i], projectiles.pos_y[i] + move_y[i]) + half_size;
+ }
+}
+
+ProjectileMotion integrate_projectiles(float dt)
+{
+ int count = projectiles.count;
+ ProjectileMotion to_return = {
+  .count = count,
+  .move_x = ARENA_PUSH(&scratch, float, count),
+  .move_y = ARENA_PUSH(&scratch, float, count),
+  .min_x = ARENA_PUSH(&scratch, float, count),
+  .min_y = ARENA_PUSH(&scratch, float, count),
+  .max_x = ARENA_PUSH(&scratch, float, count),
+  .max_y = ARENA_PUSH(&scratch, float, count),
+ };
+ IntegrateProjectiles job = { .motion = to_return, .dt = dt };
+ parallel_for(count, PROJECTILE_BATCH, integrate_projectiles_job, &job);
+ return to_return;
+}
+
+typedef struct CollideProjectiles
+{
+ Level *level;
+ ProjectileMotion *motion;
+ EntitySpan near; // entities near any of the projectiles
+ // per projectile, what it hit and when
+ float *entity_toi;
+ Entity **hit;
+ bool *dead;
+} CollideProjectiles;
+
+// sweeps a batch of projectiles against the entities and tiles, and moves the ones that
+// don't hit anything. Only writes to its own projectiles, the hits are pushed after
+void collide_projectiles_job(void *data, int from, int to)
+{
+ CollideProjectiles *job = data;
+ Level *l = job->level;
+ ProjectileMotion *motion = job->motion;
+ float *move_x = motion->move_x;
+ float *move_y = motion->move_y;
+ float *min_x = motion->min_x;
+ float *min_y = motion->min_y;
+ float *max_x = motion->max_x;
+ float *max_y = motion->max_y;
+ float *entity_toi = job->entity_toi;
+ Entity **hit = job->hit;
+ int count = to - from;
+ assert(from % 64 == 0);
+
+ // there are way fewer entities than projectiles, so each entity near any of them is
+ // tested against all the projectiles' swept boxes at once, then the ones it overlaps
+ // are swept against it exactly
+ for(int i = from; i < to; i++)
+ {
+  entity_toi[i] = INFINITY;
+  hit[i] = NULL;
+ }
+ uint64_t *hit_mask = ARENA_PUSH(&scratch, uint64_t, (count + 63)/64);
+ SPAN_ITER(Entity *, &job->near)
+ {
+  Entity *e = *it;
+  if(e->intangible) continue;
+  AABB target = entity_aabb(e);
+  overlap_mask(min_x + from, min_y + from, max_x + from, max_y + from, count, target, hit_mask);
+  for(int word = 0; word < (count + 63)/64; word++)
+  {
+   for(uint64_t bits = hit_mask[word]; bits != 0; bits &= bits - 1)
+   {
+    int i = from + word*64 + lowest_set_bit(bits);
+    float toi;
+    if(swept_aabb(projectile_aabb(i), V2(move_x[i], move_y[i]), target, &toi) && toi < entity_toi[i])
+    {
+     entity_toi[i] = toi;
+     hit[i] = e;
+    }
+   }
+  }
+ }
+
+ for(int i = from; i < to; i++)
+ {
+  Vec2 movement = V2(move_x[i], move_y[i]);
+  float tile_toi = INFINITY;
+  TileCoord hit_tile;
+  // most are out in the open, and checking the bitset is much cheaper than sweeping
+  AABB swept = { .upper_left = V2(min_x[i], max_y[i]), .lower_right = V2(max_x[i], min_y[i]) };
+  if(any_solid_tile_in_aabb(l, swept)) sweep_tiles(l, projectile_aabb(i), movement, &tile_toi, &hit_tile);
+
+  Vec2 pos = V2(projectiles.pos_x[i], projectiles.pos_y[i]);
+  if(hit[i] && entity_toi[i] <= tile_toi)
+  {
+   job->dead[i] = true;
+  }
+  else if(tile_toi <= 1.0f)
+  {
+   hit[i] = NULL;
+   job->dead[i] = true;
+  }
+  else
+  {
+   hit[i] = NULL;
+   pos = AddV2(pos, movement);
+   projectiles.pos_x[i] = pos.X;
+   projectiles.pos_y[i] = pos.Y;
+   job->dead[i] = !has_point(level_aabb, pos);
+  }
+ }
+}
+
+// moves the projectiles, swept so fast ones and big dt don't tunnel through things.
+// Each one stops at the first entity or solid tile in its way, pushing a hit command
+// for entities. Batches of them are done in parallel
+void collide_projectiles(Level *l, ProjectileMotion *motion)
+{
+ int count = motion->count;
+ if(count == 0) return;
+
+ AABB all_swept = { .upper_left = V2(INFINITY, -INFINITY), .lower_right = V2(-INFINITY, INFINITY) };
+ for(int i = 0; i < count; i++)
+ {
+  all_swept.upper_left.X = fminf(all_swept.upper_left.X, motion->min_x[i]);
+  all_swept.upper_left.Y = fmaxf(all_swept.upper_left.Y, motion->max_y[i]);
+  all_swept.lower_right.X = fmaxf(all_swept.lower_right.X, motion->max_x[i]);
+  all_swept.lower_right.Y = fminf(all_swept.lower_right.Y, motion->min_y[i]);
+ }
+
+ CollideProjectiles job = {
+  .level = l,
+  .motion = motion,
+  .near = overlapping_entities(all_swept),
+  .entity_toi = ARENA_PUSH(&scratch, float, count),
+  .hit = ARENA_PUSH(&scratch, Entity *, count),
+  .dead = ARENA_PUSH(&scratch, bool, count),
+ };
+ parallel_for(count, PROJECTILE_BATCH, collide_projectiles_job, &job);
+
+ // in projectile order, so the commands are the same however the batches ran
+ for(int i = 0; i < count; i++)
+ {
+  if(job.hit[i] == NULL) continue;
+  Vec2 impact = AddV2(V2(projectiles.pos_x[i], projectiles.pos_y[i]), MulV2F(V2(motion->move_x[i], motion->move_y[i]), job.entity_toi[i]));
+  push_command((Command){ .kind = COMMAND_HIT, .entity = entity_handle(job.hit[i]), .pos = impact, .damage = 0.2f });
+ }
+
+ // packed back down in order, so which ones die doesn't shuffle the rest
+ int num_kept = 0;
+ for(int i = 0; i < count; i++)
+ {
+  if(job.dead[i]) continue;
+  projectiles.pos_x[num_kept] = projectiles.pos_x[i];
+  projectiles.pos_y[num_kept] = projectiles.pos_y[i];
+  projectiles.prev_x[num_kept] = projectiles.prev_x[i];
+  projectiles.prev_y[num_kept] = projectiles.prev_y[i];
+  projectiles.vel_x[num_kept] = projectiles.vel_x[i];
+  projectiles.vel_y[num_kept] = projectiles.vel_y[i];
+  num_kept++;
+ }
+ projectiles.count = num_kept;
+}
+
+// the simulation runs as a few passes, each one going over a kind at a time.
+// How long each took last frame is in the devtools stats
+typedef enum SimPass
+{
+ PASS_AI,
+ PASS_INTEGRATE,
+ PASS_COLLIDE,
+ PASS_RENDER,
+ PASS_LAST,
+} SimPass;
+
+const char *pass_names[PASS_LAST] = { "AI", "Integrate", "Collide", "Render" };
+double pass_times[PASS_LAST] = {0}; // in seconds
+
+// adds how long it's been since *start, and restarts it for the next pass. There can
+// be a few ticks a frame, so the times are added up and cleared every frame
+void end_pass(SimPass pass, uint64_t *start)
+{
+ pass_times[pass] += stm_sec(stm_laptime(start));
+}
+
+// where to draw it, alpha of the way from before the last tick to after it
+Vec2 interpolated_pos(Entity *e, float alpha)
+{
+ return LerpV2(e->prev_pos, alpha, e->pos);
+}
+
+#define OLD_MEN_BATCH 64
+
+typedef struct OldMenAI
+{
+ Entity *player;
+ float dt;
+ Command *shots; // archetype's shots for each old man, pushed in order after
+ int *num_shots;
+} OldMenAI;
+
+void old_men_ai_job(void *data, int from, int to)
+{
+ OldMenAI *job = data;
+ Entity *player = job->player;
+ float dt = job->dt;
+ const EntityArchetype *a = &archetypes[ENTITY_OLD_MAN];
+ for(int index = from; index < to; index++)
+ {
+  OldMan *it = &old_men.data[index];
+  job->num_shots[index] = 0;
+  if(!it->aggressive) continue;
+  Entity *e = &entities[it->entity];
+  it->shotgun_timer += dt;
+  Vec2 to_player = NormV2(SubV2(player->pos, e->pos));
+  if(it->shotgun_timer >= a->fire_interval)
+  {
+   it->shotgun_timer = 0.0f;
+   // shoot shotgun
+   Command *shots = &job->shots[index * a->shots];
+   for(int i = 0; i < a->shots; i++)
+   {
+    Vec2 dir = to_player;
+    float theta = a->shots > 1 ? Lerp(-a->spread/2.0f, ((float)i / (float)(a->shots - 1)), a->spread/2.0f) : 0.0f;
+    dir = RotateV2(dir, theta);
+    shots[i] = (Command){ .kind = COMMAND_SPAWN_PROJECTILE, .pos = AddV2(e->pos, MulV2F(dir, a->muzzle_distance)), .vel = MulV2F(dir, a->projectile_speed) };
+    e->vel = AddV2(e->vel, MulV2F(dir, -a->recoil));
+   }
+   job->num_shots[index] = a->shots;
+  }
+
+  Vec2 target_vel = NormV2(AddV2(rotate_counter_clockwise(to_player), MulV2F(to_player, 0.5f)));
+  target_vel = MulV2F(target_vel, a->speed);
+  e->vel = LerpV2(e->vel, 15.0f * dt, target_vel);
+ }
+}
+
+// in parallel for big crowds, each old man only changes himself
+void old_men_ai(Entity *player, float dt)
+{
+ int count = old_men.cur_index;
+ int max_shots = archetypes[ENTITY_OLD_MAN].shots;
+ OldMenAI job = {
+  .player = player,
+  .dt = dt,
+  .shots = ARENA_PUSH(&scratch, Command, count * max_shots),
+  .num_shots = ARENA_PUSH(&scratch, int, count),
+ };
+ parallel_for(count, OLD_MEN_BATCH, old_men_ai_job, &job);
+ for(int i = 0; i < count; i++)
+ {
+  for(int shot = 0; shot < job.num_shots[i]; shot++) push_command(job.shots[i * max_shots + shot]);
+ }
+}
+
+// only aggressive old men move
+void old_men_integrate(float dt)
+{
+ BUFF_ITER(OldMan, &old_men)
+ {
+  if(!it->aggressive) continue;
+  Entity *e = &entities[it->entity];
+  e->pos = AddV2(e->pos, MulV2F(e->vel, pixels_per_meter * dt));
+  spatial_hash_update(e);
+ }
+}
+
+void old_men_collide()
+{
+ BUFF_ITER(OldMan, &old_men)
+ {
+  if(!it->aggressive) continue;
+  Entity *e = &entities[it->entity];
+  e->pos = depenetrate(e, e->pos);
+  spatial_hash_update(e);
+ }
+}
+
+// works out the player's state and velocity from the input
+void player_ai(Entity *player, Input input, float dt)
+{
+ Character *c = character(player);
+ const EntityArchetype *a = &archetypes[player->kind];
+ if(input.attack && (c->state == CHARACTER_IDLE || c->state == CHARACTER_WALKING))
+ {
+  c->state = CHARACTER_ATTACK;
+  c->swing_progress = 0.0;
+ }
+
+ // rolling
+ if(input.roll && !c->is_rolling && c->time_not_rolling > 0.3f && (c->state == CHARACTER_IDLE || c->state == CHARACTER_WALKING))
+ {
+  c->is_rolling = true;
+  c->roll_progress = 0.0;
+  c->speed = a->roll_speed;
+ }
+ if(c->state != CHARACTER_IDLE && c->state != CHARACTER_WALKING)
+ {
+  c->roll_progress = 0.0;
+  c->is_rolling = false;
+ }
+ if(c->is_rolling)
+ {
+  c->time_not_rolling = 0.0f;
+  c->roll_progress += dt;
+  if(c->roll_progress > anim_sprite_duration(a->rolling))
+  {
+   c->is_rolling = false;
+  }
+ }
+ if(!c->is_rolling) c->time_not_rolling += dt;
+ player->intangible = c->is_rolling;
+
+ player->vel = V2(0.0f, 0.0f);
+ if(c->state == CHARACTER_WALKING)
+ {
+  if(c->speed <= 0.01f) c->speed = a->speed;
+  c->speed = Lerp(c->speed, dt * 3.0f, a->speed);
+  player->vel = MulV2F(input.movement, c->speed);
+
+  if(LenV2(input.movement) == 0.0)
+  {
+   c->state = CHARACTER_IDLE;
+  }
+  else
+  {
+   c->facing_left = input.movement.X < 0.0f;
+  }
+ }
+ else if(c->state == CHARACTER_IDLE)
+ {
+  if(LenV2(input.movement) > 0.01) c->state = CHARACTER_WALKING;
+ }
+ else if(c->state == CHARACTER_ATTACK)
+ {
+  AABB weapon_aabb = {0};
+  if(c->facing_left)
+  {
+   weapon_aabb = (AABB){
+    .upper_left = AddV2(player->pos, V2(-40.0, 25.0)),
+    .lower_right = AddV2(player->pos, V2(0.0, -25.0)),
+   };
+  }
+  else
+  {
+   weapon_aabb = (AABB){
+    .upper_left = AddV2(player->pos, V2(0.0, 25.0)),
+    .lower_right = AddV2(player->pos, V2(40.0, -25.0)),
+   };
+  }
+  sim_dbgrect(weapon_aabb);
+  Overlapping overlapping_weapon = get_overlapping(&level_level0, weapon_aabb, (OverlapFilter){ .no_tiles = true, .kinds = KIND_BIT(ENTITY_OLD_MAN) });
+  SPAN_ITER(Overlap, &overlapping_weapon)
+  {
+   push_command((Command){ .kind = COMMAND_PROVOKE, .entity = entity_handle(it->e) });
+  }
+
+  c->swing_progress += dt;
+  if(c->swing_progress > anim_sprite_duration(a->attack))
+  {
+   c->state = CHARACTER_IDLE;
+  }
+ }
+}
+
+// characters only move while walking
+void characters_integrate(float dt)
+{
+ BUFF_ITER(Character, &characters)
+ {
+  if(it->state != CHARACTER_WALKING) continue;
+  Entity *e = &entities[it->entity];
+  e->pos = AddV2(e->pos, MulV2F(e->vel, pixels_per_meter * dt));
+  spatial_hash_update(e);
+ }
+}
+
+void characters_collide()
+{
+ BUFF_ITER(Character, &characters)
+ {
+  if(it->state != CHARACTER_WALKING) continue;
+  Entity *e = &entities[it->entity];
+  e->pos = depenetrate(e, e->pos);
+  spatial_hash_update(e);
+ }
+}
+
+uint64_t num_ticks = 0; // since starting
+
+// advances the simulation by one fixed step
+void tick(Input input, float dt)
+{
+#ifdef DEVTOOLS
+ debug_rects.cur_index = 0;
+#endif
+ ALIVE_ENTITIES_ITER
+ {
+  it->prev_pos = it->pos;
+ }
+ memcpy(projectiles.prev_x, projectiles.pos_x, sizeof(float)*projectiles.count);
+ memcpy(projectiles.prev_y, projectiles.pos_y, sizeof(float)*projectiles.count);
+
+ Entity *player = get_entity(player_handle);
+ assert(player != NULL);
+ uint64_t pass_start = stm_now();
+
+ old_men_ai(player, dt);
+ player_ai(player, input, dt);
+ end_pass(PASS_AI, &pass_start);
+
+ old_men_integrate(dt);
+ characters_integrate(dt);
+ ProjectileMotion projectile_motion = integrate_projectiles(dt);
+ end_pass(PASS_INTEGRATE, &pass_start);
+
+ old_men_collide();
+ characters_collide();
+ collide_projectiles(&level_level0, &projectile_motion);
+
+ // everything above only pushed spawns and hits
+ apply_commands();
+ end_pass(PASS_COLLIDE, &pass_start);
+
+ // health
+ if(player->damage >= 1.0)
+ {
+  reset_level();
+ }
+
+ num_ticks += 1;
+}
+
+// recordings are every tick's input from the level first loading, so replaying them
+// from the same start gives the same simulation. The simulation has no randomness,
+// so there's no seed to go with it. Format is the header, then one InputKeys per tick
+#define RECORDING_MAGIC 0x52475052 // "RPGR" little endian
+#define RECORDING_VERSION 1
+typedef struct RecordingHeader
+{
+ uint32_t magic;
+ uint32_t version;
+ uint32_t tick_rate; // ticks recorded at a different rate won't replay the same
+ uint32_t max_entities; // or with a different pool, which changes slot reuse
+} RecordingHeader;
+
+const char *record_path = NULL; // from the command line
+const char *replay_path = NULL;
+FILE *recording_file = NULL;
+
+RecordingHeader recording_header()
+{
+ return (RecordingHeader){ .magic = RECORDING_MAGIC, .version = RECORDING_VERSION, .tick_rate = TICK_RATE, .max_entities = MAX_ENTITIES };
+}
+
+// to check a replay ends up exactly where the recording did, and that changes to the
+// simulation don't change what it does. Goes field by field so padding isn't hashed
+#define FNV_OFFSET 14695981039346656037ull
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+ const uint8_t *bytes = data;
+ for(size_t i = 0; i < size; i++)
+ {
+  hash ^= bytes[i];
+  hash *= 1099511628211ull;
+ }
+ return hash;
+}
+#define HASH(hash, field) hash = fnv1a(hash, &(field), sizeof(field))
+
+uint64_t hash_sim_state()
+{
+ uint64_t h = FNV_OFFSET;
+ HASH(h, num_ticks);
+ HASH(h, player_handle.index);
+ HASH(h, num_alive_entities);
+ for(uint32_t i = 0; i < num_alive_entities; i++)
+ {
+  Entity *e = &entities[alive_entities[i]];
+  HASH(h, alive_entities[i]);
+  HASH(h, entity_generations[alive_entities[i]]);
+  HASH(h, e->intangible);
+  HASH(h, e->kind);
+  HASH(h, e->pos);
+  HASH(h, e->vel);
+  HASH(h, e->damage);
+  HASH(h, e->component);
+ }
+ BUFF_ITER(OldMan, &old_men)
+ {
+  HASH(h, it->entity);
+  HASH(h, it->aggressive);
+  HASH(h, it->shotgun_timer);
+ }
+ BUFF_ITER(Character, &characters)
+ {
+  HASH(h, it->entity);
+  HASH(h, it->state);
+  HASH(h, it->facing_left);
+  HASH(h, it->is_rolling);
+  HASH(h, it->speed);
+  HASH(h, it->time_not_rolling);
+  HASH(h, it->roll_progress);
+  HASH(h, it->swing_progress);
+ }
+ HASH(h, projectiles.count);
+ h = fnv1a(h, projectiles.pos_x, sizeof(float)*projectiles.count);
+ h = fnv1a(h, projectiles.pos_y, sizeof(float)*projectiles.count);
+ h = fnv1a(h, projectiles.vel_x, sizeof(float)*projectiles.count);
+ h = fnv1a(h, projectiles.vel_y, sizeof(float)*projectiles.count);
+ return h;
+}
+
+void record_tick(InputKeys keys)
+{
+ if(recording_file == NULL) return;
+ fwrite(&keys, sizeof(keys), 1, recording_file);
+}
+
+void start_recording()
+{
+ recording_file = fopen(record_path, "wb");
+ assert(recording_file != NULL);
+ RecordingHeader header = recording_header();
+ fwrite(&header, sizeof(header), 1, recording_file);
+}
+
+void stop_recording()
+{
+ if(recording_file == NULL) return;
+ fclose(recording_file);
+ recording_file = NULL;
+ printf("Recorded %llu ticks to %s, state hash %016llx\n", (unsigned long long)num_ticks, record_path, (unsigned long long)hash_sim_state());
+}
+
+// runs every tick of the recording at replay_path as fast as it can, from the level
+// just loaded, then prints how long it took and where it ended up
+void replay()
+{
+ FILE *file = fopen(replay_path, "rb");
+ if(file == NULL)
+ {
+  fprintf(stderr, "Couldn't open recording %s\n", replay_path);
+  return;
+ }
+ RecordingHeader header = {0};
+ RecordingHeader expected = recording_header();
+ // shorter than a header isn't a recording either
+ if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(&header, &expected, sizeof(header)) != 0)
+ {
+  fprintf(stderr, "%s isn't a recording of this version of the game at this tick rate\n", replay_path);
+  fclose(file);
+  return;
+ }
+ fseek(file, 0, SEEK_END);
+ long size = ftell(file) - (long)sizeof(header);
+ fseek(file, sizeof(header), SEEK_SET);
+ InputKeys *keys = malloc(size);
+ size_t read = fread(keys, 1, size, file);
+ fclose(file);
+ if(read != (size_t)size)
+ {
+  fprintf(stderr, "Couldn't read all of recording %s\n", replay_path);
+  free(keys);
+  return;
+ }
+
+ for(int i = 0; i < PASS_LAST; i++) pass_times[i] = 0.0;
+ double slowest_tick = 0.0;
+ uint64_t start = stm_now();
+ for(long i = 0; i < size; i++)
+ {
+  uint64_t tick_start = stm_now();
+  tick(input_from_keys(keys[i]), (float)TICK_DT);
+  reset(&scratch);
+  slowest_tick = fmax(slowest_tick, stm_sec(stm_since(tick_start)));
+ }
+ double total = stm_sec(stm_since(start));
+ free(keys);
+
+ printf("Replayed %ld ticks in %.2f ms, %.1f us per tick, slowest %.1f us\n", size, total*1000.0, size > 0 ? total*1e6/size : 0.0, slowest_tick*1e6);
+ for(int i = 0; i < PASS_LAST; i++) printf("%s: %.2f ms\n", pass_names[i], pass_times[i]*1000.0);
+ printf("State hash %016llx\n", (unsigned long long)hash_sim_state());
+}
+
+
+// snapshots are the simulation's globals copied out as they are, nothing in them is a
+// pointer so they can be copied straight back. A few megabytes of memcpy, so saving
+// and restoring take microseconds. For saving or sending they're encoded as the xor
+// with an older snapshot, or with nothing, and runs of zero words squashed, so only
+// what changed takes up space
+typedef struct SnapshotRegion
+{
+ void *data;
+ size_t size;
+} SnapshotRegion;
+
+// commands aren't in here, snapshots are taken between ticks when there aren't any
+SnapshotRegion sim_snapshot_regions[] = {
+ { entities, sizeof(entities) },
+ { &old_men, sizeof(old_men) },
+ { &characters, sizeof(characters) },
+ { entity_generations, sizeof(entity_generations) },
+ { free_entities, sizeof(free_entities) },
+ { &num_free_entities, sizeof(num_free_entities) },
+ { alive_entities, sizeof(alive_entities) },
+ { alive_index, sizeof(alive_index) },
+ { &num_alive_entities, sizeof(num_alive_entities) },
+ { &player_handle, sizeof(player_handle) },
+ { &spatial_hash, sizeof(spatial_hash) },
+ { &entity_bounds, sizeof(entity_bounds) },
+ { &projectiles, sizeof(projectiles) },
+ { &level_aabb, sizeof(level_aabb) },
+ { &num_ticks, sizeof(num_ticks) },
+};
+
+// things outside the simulation that go back with it, like the camera
+BUFF(SnapshotRegion, 16) extra_snapshot_regions = {0};
+
+void add_snapshot_region(void *data, size_t size)
+{
+ BUFF_APPEND(&extra_snapshot_regions, ((SnapshotRegion){ data, size }));
+}
+
+// every region starts on a word, so the encoding can work a word at a time
+#define SNAPSHOT_WORDS(size) (((size) + sizeof(uint64_t) - 1)/sizeof(uint64_t))
+
+#define SNAPSHOT_ITER for(int region_i = 0; region_i < ARRLEN(sim_snapshot_regions) + extra_snapshot_regions.cur_index; region_i++) for(SnapshotRegion *it = region_i < ARRLEN(sim_snapshot_regions) ? &sim_snapshot_regions[region_i] : &extra_snapshot_regions.data[region_i - ARRLEN(sim_snapshot_regions)]; it != NULL; it = NULL)
+
+// in words
+size_t snapshot_size()
+{
+ size_t to_return = 0;
+ SNAPSHOT_ITER to_return += SNAPSHOT_WORDS(it->size);
+ return to_return;
+}
+
+void save_snapshot(uint64_t *snapshot)
+{
+ assert(commands.cur_index == 0);
+ SNAPSHOT_ITER
+ {
+  memcpy(snapshot, it->data, it->size);
+  size_t words = SNAPSHOT_WORDS(it->size);
+  if(words*sizeof(uint64_t) != it->size) memset((char *)snapshot + it->size, 0, words*sizeof(uint64_t) - it->size);
+  snapshot += words;
+ }
+}
+
+void load_snapshot(const uint64_t *snapshot)
+{
+ SNAPSHOT_ITER
+ {
+  memcpy(it->data, snapshot, it->size);
+  snapshot += SNAPSHOT_WORDS(it->size);
+ }
+ commands.cur_index = 0;
+}
+
+#define SNAPSHOT_MAGIC 0x50414E53 // "SNAP" little endian
+#define SNAPSHOT_VERSION 1
+typedef struct EncodedSnapshotHeader
+{
+ uint32_t magic;
+ uint32_t version;
+ uint64_t words; // of the snapshot, which has to match snapshot_size() to decode
+ uint32_t is_delta; // against some older snapshot, which decoding needs too
+ uint32_t max_entities;
+} EncodedSnapshotHeader;
+
+// the most encoding can take, when nothing is the same
+size_t max_encoded_snapshot_size(size_t words)
+{
+ return sizeof(EncodedSnapshotHeader) + words*sizeof(uint64_t) + (words + 1)*2*sizeof(uint32_t);
+}
+
+// xors with base, which can be NULL, then writes pairs of how many zero words and how
+// many words that aren't, followed by those. Returns the size written to out
+size_t encode_snapshot(const uint64_t *snapshot, const uint64_t *base, size_t words, uint8_t *out)
+{
+ EncodedSnapshotHeader header = { .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .words = words, .is_delta = base != NULL, .max_entities = MAX_ENTITIES };
+ memcpy(out, &header, sizeof(header));
+ uint8_t *cur = out + sizeof(header);
+#define WORD(i) (base ? snapshot[i] ^ base[i] : snapshot[i])
+ size_t i = 0;
+ while(i < words)
+ {
+  uint32_t zeros = 0;
+  while(i < words && WORD(i) == 0 && zeros < UINT32_MAX) { zeros++; i++; }
+  size_t literal_start = i;
+  uint32_t literals = 0;
+  // a lone zero word in the middle of changes isn't worth a new pair
+  while(i < words && (WORD(i) != 0 || (i + 1 < words && WORD(i + 1) != 0)) && literals < UINT32_MAX) { literals++; i++; }
+  memcpy(cur, &zeros, sizeof(zeros)); cur += sizeof(zeros);
+  memcpy(cur, &literals, sizeof(literals)); cur += sizeof(literals);
+  for(size_t w = literal_start; w < literal_start + literals; w++)
+  {
+   uint64_t word = WORD(w);
+   memcpy(cur, &word, sizeof(word));
+   cur += sizeof(word);
+  }
+ }
+#undef WORD
+ return cur - out;
+}
+
+// the other way around, base has to be the same snapshot it was encoded against.
+// Returns false if it isn't an encoding of a snapshot like this one
+bool decode_snapshot(const uint8_t *encoded, size_t size, const uint64_t *base, uint64_t *snapshot, size_t words)
+{
+ EncodedSnapshotHeader header;
+ if(size < sizeof(header)) return false;
+ memcpy(&header, encoded, sizeof(header));
+ if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.words != words || header.max_entities != MAX_ENTITIES) return false;
+ if(header.is_delta && base == NULL) return false;
+ if(!header.is_delta) base = NULL;
+
+ const uint8_t *cur = encoded + sizeof(header);
+ const uint8_t *end = encoded + size;
+ size_t i = 0;
+ while(i < words)
+ {
+  uint32_t zeros, literals;
+  if(end - cur < 2*sizeof(uint32_t)) return false;
+  memcpy(&zeros, cur, sizeof(zeros)); cur += sizeof(zeros);
+  memcpy(&literals, cur, sizeof(literals)); cur += sizeof(literals);
+  if(i + zeros + literals > words || (size_t)(end - cur) < literals*sizeof(uint64_t)) return false;
+  if(base) memcpy(&snapshot[i], &base[i], zeros*sizeof(uint64_t));
+  else memset(&snapshot[i], 0, zeros*sizeof(uint64_t));
+  i += zeros;
+  for(uint32_t l = 0; l < literals; l++)
+  {
+   uint64_t word;
+   memcpy(&word, cur, sizeof(word));
+   cur += sizeof(word);
+   snapshot[i] = base ? base[i] ^ word : word;
+   i++;
+  }
+ }
+ return true;
+}
+
+// a whole snapshot, not a delta, so it can be loaded on its own
+bool write_snapshot_file(const char *path)
+{
+ size_t words = snapshot_size();
+ uint64_t *snapshot = malloc(words*sizeof(uint64_t));
+ uint8_t *encoded = malloc(max_encoded_snapshot_size(words));
+ save_snapshot(snapshot);
+ size_t size = encode_snapshot(snapshot, NULL, words, encoded);
+ FILE *file = fopen(path, "wb");
+ bool written = file != NULL && fwrite(encoded, 1, size, file) == size;
+ if(file) fclose(file);
+ free(snapshot);
+ free(encoded);
+ return written;
+}
+
+bool read_snapshot_file(const char *path)
+{
+ FILE *file = fopen(path, "rb");
+ if(file == NULL) return false;
+ fseek(file, 0, SEEK_END);
+ size_t size = (size_t)ftell(file);
+ fseek(file, 0, SEEK_SET);
+ uint8_t *encoded = malloc(size);
+ bool read = fread(encoded, 1, size, file) == size;
+ fclose(file);
+
+ size_t words = snapshot_size();
+ uint64_t *snapshot = malloc(words*sizeof(uint64_t));
+ bool decoded = read && decode_snapshot(encoded, size, NULL, snapshot, words);
+ if(decoded) load_snapshot(snapshot);
+ free(snapshot);
+ free(encoded);
+ return decoded;
+}